@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2022-2024 Emil Engler <me@emilengler.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "litev.h"
+#include "litev-internal.h"
+#include "mem.h"
+
+/*
+ * The outbound buffer of a proxied stream, of which only the amount of
+ * queued bytes is known.  The kernel is only involved when the queue
+ * crosses one of the watermarks, hence is_paused is only set if the
+ * upstream event has actually been disabled by us.
+ */
+struct litev_bp {
+	struct litev_base	*base;
+	struct litev_handle	 upstream;
+	size_t			 low;
+	size_t			 high;
+	size_t			 queued;
+	int			 is_paused;
+};
+
+/*
+ * Create the backpressure of the event behind the handle upstream, which
+ * is disabled while more than high bytes are queued and enabled again once
+ * no more than low bytes are left.
+ */
+struct litev_bp *
+litev_bp_init(struct litev_base *base, const struct litev_handle *upstream,
+    size_t low, size_t high)
+{
+	struct litev_bp	*bp;
+
+	if (base == NULL || upstream == NULL || low > high)
+		return (NULL);
+
+	if ((bp = mem_malloc(base, sizeof(struct litev_bp))) == NULL)
+		return (NULL);
+	bp->base = base;
+	bp->upstream = *upstream;
+	bp->low = low;
+	bp->high = high;
+	bp->queued = 0;
+	bp->is_paused = 0;
+
+	return (bp);
+}
+
+/*
+ * Free the backpressure, enabling the upstream event again if it has been
+ * paused.
+ */
+void
+litev_bp_free(struct litev_bp **bp_ptr)
+{
+	struct litev_bp	*bp;
+
+	if (bp_ptr == NULL || (bp = *bp_ptr) == NULL)
+		return;
+
+	/* The handle is stale, if the event is gone already. */
+	if (bp->is_paused)
+		litev_enable(bp->base, &bp->upstream);
+
+	mem_free(bp->base, bp);
+	*bp_ptr = NULL;
+}
+
+/*
+ * Account for n bytes that have been appended to the outbound buffer.
+ */
+int
+litev_bp_queue(struct litev_bp *bp, size_t n)
+{
+	int	rc;
+
+	if (bp == NULL)
+		return (LITEV_EINVAL);
+	if (n > SIZE_MAX - bp->queued)
+		return (LITEV_EOVERFLOW);
+
+	bp->queued += n;
+	if (bp->is_paused || bp->queued <= bp->high)
+		return (LITEV_OK);
+
+	/* The event may have been disabled by the caller already. */
+	rc = litev_disable(bp->base, &bp->upstream);
+	if (rc == LITEV_OK)
+		bp->is_paused = 1;
+
+	return (rc == LITEV_EALREADY ? LITEV_OK : rc);
+}
+
+/*
+ * Account for n bytes that have been written from the outbound buffer.
+ */
+int
+litev_bp_drain(struct litev_bp *bp, size_t n)
+{
+	int	rc;
+
+	if (bp == NULL || n > bp->queued)
+		return (LITEV_EINVAL);
+
+	bp->queued -= n;
+	if (!bp->is_paused || bp->queued > bp->low)
+		return (LITEV_OK);
+
+	bp->is_paused = 0;
+	rc = litev_enable(bp->base, &bp->upstream);
+
+	return (rc == LITEV_EALREADY ? LITEV_OK : rc);
+}
+
+size_t
+litev_bp_queued(struct litev_bp *bp)
+{
+	return (bp != NULL ? bp->queued : 0);
+}
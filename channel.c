@@ -0,0 +1,267 @@
+/*
+ * Copyright (c) 2022-2024 Emil Engler <me@emilengler.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#ifdef USE_EVENTFD
+#include <sys/eventfd.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "litev.h"
+#include "litev-internal.h"
+#include "mem.h"
+
+/* Keeps the indices of producer and consumer apart in memory. */
+#define CACHELINE	64
+
+/*
+ * A bounded ring of messages from a producer on any thread to a consumer
+ * base.  head and tail run freely and only the producer writes tail, while
+ * only the consumer writes head, each caching the index of the other side
+ * in order to not touch its cache line on every message.  is_armed is set
+ * by the consumer once the ring is empty and cleared by the first producer
+ * that sees it, which then wakes the consumer up through fd[1].  Both sides
+ * write their index before reading is_armed or the other index with
+ * sequential consistency, so that a message cannot slip past an arming.
+ */
+struct litev_chan {
+	struct litev_base	 *base;
+	void			**ring;
+	size_t			  mask;
+	void			(*cb)(void **, size_t, void *);
+	void			 *udata;
+	int			  fd[2];
+
+	unsigned char		  pad0[CACHELINE];
+	size_t			  tail;
+	size_t			  head_cache;
+
+	unsigned char		  pad1[CACHELINE];
+	size_t			  head;
+	size_t			  tail_cache;
+
+	unsigned char		  pad2[CACHELINE];
+	int			  is_armed;
+	unsigned char		  pad3[CACHELINE];
+};
+
+static int	chan_wake(struct litev_chan *);
+static void	chan_cb(int, short, void *);
+
+static int
+chan_wake(struct litev_chan *ch)
+{
+#ifdef USE_EVENTFD
+	uint64_t	one;
+
+	one = 1;
+	if (write(ch->fd[1], &one, sizeof(one)) == -1)
+		return (-1);
+#else
+	char	c;
+
+	/* A full pipe wakes the consumer up just as well. */
+	c = 0;
+	if (write(ch->fd[1], &c, 1) == -1 && errno != EAGAIN)
+		return (-1);
+#endif
+
+	return (LITEV_OK);
+}
+
+/*
+ * Deliver the messages to the callback in batches of consecutive slots, but
+ * at most one ring worth per wakeup, so that a busy producer cannot starve
+ * the other events of the consumer.
+ */
+static void
+chan_cb(int fd, short condition, void *udata)
+{
+	struct litev_chan	*ch;
+	size_t			 head, tail, end, n;
+#ifdef USE_EVENTFD
+	uint64_t		 cnt;
+
+	read(fd, &cnt, sizeof(cnt));
+#else
+	char			 buf[64];
+
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+#endif
+
+	ch = udata;
+	head = ch->head;
+	end = head + ch->mask + 1;
+	for (;;) {
+		if ((tail = ch->tail_cache) == head) {
+			tail = __atomic_load_n(&ch->tail, __ATOMIC_ACQUIRE);
+			ch->tail_cache = tail;
+		}
+		if (tail == head) {
+			/* Go to sleep, unless a message has arrived by now. */
+			__atomic_store_n(&ch->is_armed, 1, __ATOMIC_SEQ_CST);
+			tail = __atomic_load_n(&ch->tail, __ATOMIC_SEQ_CST);
+			if (tail == head)
+				return;
+			__atomic_store_n(&ch->is_armed, 0, __ATOMIC_RELAXED);
+			continue;
+		}
+		if (head == end) {
+			chan_wake(ch);
+			return;
+		}
+
+		if (tail - head > end - head)
+			tail = end;
+		n = tail - head;
+		if (n > ch->mask + 1 - (head & ch->mask))
+			n = ch->mask + 1 - (head & ch->mask);
+
+		ch->cb(&ch->ring[head & ch->mask], n, ch->udata);
+		head += n;
+		__atomic_store_n(&ch->head, head, __ATOMIC_RELEASE);
+	}
+}
+
+/*
+ * Create a channel of at least capacity messages, which are delivered to cb
+ * from within base.  Only one thread may send at a time.
+ */
+struct litev_chan *
+litev_chan_init(struct litev_base *base, size_t capacity,
+    void (*cb)(void **, size_t, void *), void *udata)
+{
+	struct litev_chan	*ch;
+	struct litev_ev		 ev;
+	size_t			 n;
+#ifndef USE_EVENTFD
+	size_t			 i;
+#endif
+
+	if (base == NULL || capacity == 0 || cb == NULL)
+		return (NULL);
+
+	for (n = 1; n < capacity; n <<= 1) {
+		if (n > SIZE_MAX / 2)
+			return (NULL);
+	}
+
+	if ((ch = mem_malloc(base, sizeof(struct litev_chan))) == NULL)
+		return (NULL);
+	if ((ch->ring = mem_reallocarray(base, NULL, n,
+	    sizeof(void *))) == NULL)
+		goto err;
+	ch->base = base;
+	ch->mask = n - 1;
+	ch->cb = cb;
+	ch->udata = udata;
+	ch->tail = 0;
+	ch->head_cache = 0;
+	ch->head = 0;
+	ch->tail_cache = 0;
+	ch->is_armed = 1;
+
+#ifdef USE_EVENTFD
+	if ((ch->fd[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+		goto err_ring;
+	ch->fd[1] = ch->fd[0];
+#else
+	if (pipe(ch->fd) == -1)
+		goto err_ring;
+	for (i = 0; i < 2; ++i) {
+		if (fcntl(ch->fd[i], F_SETFL, O_NONBLOCK) == -1 ||
+		    fcntl(ch->fd[i], F_SETFD, FD_CLOEXEC) == -1)
+			goto err_fd;
+	}
+#endif
+
+	ev.fd = ch->fd[0];
+	ev.condition = LITEV_READ;
+	ev.cb = chan_cb;
+	ev.udata = ch;
+	if (litev_add(base, &ev) != LITEV_OK)
+		goto err_fd;
+
+	return (ch);
+err_fd:
+	close(ch->fd[0]);
+	if (ch->fd[1] != ch->fd[0])
+		close(ch->fd[1]);
+err_ring:
+	mem_free(base, ch->ring);
+err:
+	mem_free(base, ch);
+	return (NULL);
+}
+
+/*
+ * Free the channel from the thread of its base, once the producer is done
+ * and outside of its callback.  Messages that are still queued are lost.
+ */
+void
+litev_chan_free(struct litev_chan **ch_ptr)
+{
+	struct litev_chan	*ch;
+
+	if (ch_ptr == NULL || (ch = *ch_ptr) == NULL)
+		return;
+
+	if (ch->fd[1] != ch->fd[0])
+		close(ch->fd[1]);
+	litev_close(ch->base, ch->fd[0]);
+
+	mem_free(ch->base, ch->ring);
+	mem_free(ch->base, ch);
+	*ch_ptr = NULL;
+}
+
+/*
+ * Queue msg without blocking, which fails with LITEV_EAGAIN while the
+ * channel is full.  Only the first message after the consumer has run out
+ * of messages costs a system call.
+ */
+int
+litev_chan_send(struct litev_chan *ch, void *msg)
+{
+	size_t	tail;
+
+	if (ch == NULL)
+		return (LITEV_EINVAL);
+
+	tail = ch->tail;
+	if (tail - ch->head_cache > ch->mask) {
+		ch->head_cache = __atomic_load_n(&ch->head, __ATOMIC_ACQUIRE);
+		if (tail - ch->head_cache > ch->mask)
+			return (LITEV_EAGAIN);
+	}
+
+	ch->ring[tail & ch->mask] = msg;
+	__atomic_store_n(&ch->tail, tail + 1, __ATOMIC_SEQ_CST);
+
+	/* Reading first keeps the line shared while the consumer is busy. */
+	if (__atomic_load_n(&ch->is_armed, __ATOMIC_SEQ_CST) &&
+	    __atomic_exchange_n(&ch->is_armed, 0, __ATOMIC_SEQ_CST))
+		return (chan_wake(ch));
+
+	return (LITEV_OK);
+}
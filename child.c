@@ -0,0 +1,437 @@
+/*
+ * Copyright (c) 2022-2024 Emil Engler <me@emilengler.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Required for SA_RESTART, waitid(2) and syscall(2). */
+#define _GNU_SOURCE
+
+#include "config.h"
+
+#include <sys/types.h>
+#ifdef USE_PIDFD
+#include <sys/syscall.h>
+#endif
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "litev.h"
+#include "litev-internal.h"
+#include "child.h"
+#include "mem.h"
+
+#if defined(USE_PIDFD) && !defined(P_PIDFD)
+#define P_PIDFD	3
+#endif
+
+/*
+ * The write ends of the SIGCHLD pipes of all bases that fall back to
+ * SIGCHLD, plus one, so that zero marks a free slot.
+ */
+#define NSIGCHLD	64
+
+/*
+ * The bases of different threads share the SIGCHLD handler, hence the
+ * slots, the amount of bases and the previous handler are only changed
+ * while holding sigchld_lock.  The handler itself only reads them.
+ */
+static volatile sig_atomic_t	sigchld_fds[NSIGCHLD];
+static struct sigaction		sigchld_old;
+static size_t			sigchld_nbase;
+static char			sigchld_lock;
+
+static void	child_lock(void);
+static void	child_unlock(void);
+static void	child_sigchld(int, siginfo_t *, void *);
+static int	child_pipe(struct litev_base *);
+static void	child_pipe_cb(int, short, void *);
+#ifdef USE_PIDFD
+static int	child_pidfd(struct litev_child *);
+static void	child_cb(int, short, void *);
+#endif
+static void	child_reap(struct litev_child *, const siginfo_t *);
+static void	child_unlink(struct litev_child *);
+
+/*
+ * The lock is only held for a few system calls, hence it simply spins.
+ */
+static void
+child_lock(void)
+{
+	while (__atomic_test_and_set(&sigchld_lock, __ATOMIC_ACQUIRE))
+		;
+}
+
+static void
+child_unlock(void)
+{
+	__atomic_clear(&sigchld_lock, __ATOMIC_RELEASE);
+}
+
+/*
+ * Wake up all bases that fall back to SIGCHLD and pass the signal on to the
+ * handler that has been installed before.
+ */
+static void
+child_sigchld(int sig, siginfo_t *si, void *ctx)
+{
+	size_t	i;
+	int	fd, saved_errno;
+	char	c;
+
+	saved_errno = errno;
+
+	/* A full pipe wakes the base up just as well. */
+	c = 0;
+	for (i = 0; i < NSIGCHLD; ++i) {
+		if ((fd = sigchld_fds[i]) == 0)
+			continue;
+		while (write(fd - 1, &c, 1) == -1 && errno == EINTR)
+			;
+	}
+
+	if (sigchld_old.sa_flags & SA_SIGINFO) {
+		if (sigchld_old.sa_sigaction != NULL)
+			sigchld_old.sa_sigaction(sig, si, ctx);
+	} else if (sigchld_old.sa_handler != SIG_DFL &&
+	    sigchld_old.sa_handler != SIG_IGN)
+		sigchld_old.sa_handler(sig);
+
+	errno = saved_errno;
+}
+
+/*
+ * Set up the SIGCHLD pipe of the base, unless it exists already.
+ */
+static int
+child_pipe(struct litev_base *base)
+{
+	struct sigaction	sa;
+	struct litev_ev		ev;
+	size_t			i, slot;
+	int			rc;
+
+	if (base->sigchld[0] != -1)
+		return (LITEV_OK);
+
+	child_lock();
+	for (slot = 0; slot < NSIGCHLD && sigchld_fds[slot] != 0; ++slot)
+		;
+	if (slot == NSIGCHLD) {
+		child_unlock();
+		return (LITEV_EOVERFLOW);
+	}
+
+	if (pipe(base->sigchld) == -1) {
+		child_unlock();
+		return (-1);
+	}
+	for (i = 0; i < 2; ++i) {
+		if (fcntl(base->sigchld[i], F_SETFL, O_NONBLOCK) == -1 ||
+		    fcntl(base->sigchld[i], F_SETFD, FD_CLOEXEC) == -1) {
+			rc = -1;
+			goto err;
+		}
+	}
+
+	ev.fd = base->sigchld[0];
+	ev.condition = LITEV_READ;
+	ev.cb = child_pipe_cb;
+	ev.udata = base;
+	if ((rc = litev_add(base, &ev)) != LITEV_OK)
+		goto err;
+
+	if (sigchld_nbase == 0) {
+		memset(&sa, 0, sizeof(struct sigaction));
+		sa.sa_sigaction = child_sigchld;
+		sa.sa_flags = SA_SIGINFO | SA_RESTART | SA_NOCLDSTOP;
+		sigemptyset(&sa.sa_mask);
+		if (sigaction(SIGCHLD, &sa, &sigchld_old) == -1) {
+			litev_del(base, &ev);
+			rc = -1;
+			goto err;
+		}
+	}
+	++sigchld_nbase;
+
+	base->sigchld_slot = slot;
+	sigchld_fds[slot] = base->sigchld[1] + 1;
+	child_unlock();
+
+	return (LITEV_OK);
+err:
+	child_unlock();
+	close(base->sigchld[0]);
+	close(base->sigchld[1]);
+	base->sigchld[0] = -1;
+	base->sigchld[1] = -1;
+	return (rc);
+}
+
+/*
+ * Reap all children of the base that have exited without a pidfd.  As
+ * SIGCHLD carries no reliable PID, every such child needs to be checked.
+ */
+static void
+child_pipe_cb(int fd, short condition, void *udata)
+{
+	struct litev_base	*base;
+	struct litev_child	*c;
+	siginfo_t		 si;
+	char			 buf[64];
+
+	base = udata;
+
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+
+	/* The callbacks may add or remove watchers, hence the restart. */
+restart:
+	for (c = base->children; c != NULL; c = c->next) {
+		if (c->fd != -1)
+			continue;
+
+		memset(&si, 0, sizeof(siginfo_t));
+		if (waitid(P_PID, c->pid, &si, WEXITED | WNOHANG) == -1)
+			si.si_status = errno;
+		else if (si.si_pid == 0)
+			continue;
+
+		child_reap(c, &si);
+		goto restart;
+	}
+}
+
+#ifdef USE_PIDFD
+
+/*
+ * Watch the child through a pidfd, which becomes readable once the child
+ * has exited.
+ */
+static int
+child_pidfd(struct litev_child *c)
+{
+	struct litev_ev	ev;
+	int		rc;
+
+#ifdef SYS_pidfd_open
+	c->fd = syscall(SYS_pidfd_open, c->pid, 0);
+#else
+	c->fd = -1;
+	errno = ENOSYS;
+#endif
+	if (c->fd == -1)
+		return (-1);
+	if (fcntl(c->fd, F_SETFD, FD_CLOEXEC) == -1) {
+		close(c->fd);
+		c->fd = -1;
+		return (-1);
+	}
+
+	ev.fd = c->fd;
+	ev.condition = LITEV_READ;
+	ev.cb = child_cb;
+	ev.udata = c;
+	if ((rc = litev_add(c->base, &ev)) != LITEV_OK) {
+		close(c->fd);
+		c->fd = -1;
+	}
+
+	return (rc);
+}
+
+static void
+child_cb(int fd, short condition, void *udata)
+{
+	struct litev_child	*c;
+	siginfo_t		 si;
+	int			 rc;
+
+	c = udata;
+
+	/* P_PIDFD is only known since Linux 5.4, one release after pidfds. */
+	memset(&si, 0, sizeof(siginfo_t));
+	rc = waitid(P_PIDFD, fd, &si, WEXITED | WNOHANG);
+	if (rc == -1 && errno == EINVAL)
+		rc = waitid(P_PID, c->pid, &si, WEXITED | WNOHANG);
+
+	/*
+	 * The pidfd stays readable, even if someone else has reaped the
+	 * child and waitid(2) fails with ECHILD, so the watcher must go.
+	 */
+	if (rc == -1)
+		si.si_status = errno;
+	else if (si.si_pid == 0)
+		return;
+
+	child_reap(c, &si);
+}
+
+#endif
+
+/*
+ * Forget about the reaped child c and pass its exit to the callback.  A
+ * si_code of zero means that waitid(2) failed with the errno in si_status.
+ */
+static void
+child_reap(struct litev_child *c, const siginfo_t *si)
+{
+	void	(*cb)(pid_t, int, int, void *);
+	void	 *udata;
+	pid_t	  pid;
+
+	cb = c->cb;
+	udata = c->udata;
+	pid = c->pid;
+	child_unlink(c);
+
+	cb(pid, si->si_code, si->si_status, udata);
+}
+
+static void
+child_unlink(struct litev_child *c)
+{
+	if (c->fd != -1)
+		litev_close(c->base, c->fd);
+
+	if (c->next != NULL)
+		c->next->prev = c->prev;
+	*c->prev = c->next;
+
+	mem_free(c->base, c);
+}
+
+/*
+ * Forget about all watchers, after the backend has been freed already.
+ */
+void
+child_free(struct litev_base *base)
+{
+	struct litev_child	*c;
+
+	while ((c = base->children) != NULL) {
+		base->children = c->next;
+		if (c->fd != -1)
+			close(c->fd);
+		mem_free(base, c);
+	}
+
+	if (base->sigchld[0] == -1)
+		return;
+
+	child_lock();
+	sigchld_fds[base->sigchld_slot] = 0;
+	if (--sigchld_nbase == 0)
+		sigaction(SIGCHLD, &sigchld_old, NULL);
+	child_unlock();
+	close(base->sigchld[0]);
+	close(base->sigchld[1]);
+}
+
+/*
+ * Watch the child process pid until it exits, upon which it is reaped and
+ * cb receives the si_code and si_status of waitid(2).  If waitid(2) fails,
+ * e.g. because the child has been reaped elsewhere, cb receives a si_code
+ * of zero and the errno as si_status.  On Linux, the child is watched
+ * through a pidfd, otherwise through SIGCHLD.
+ */
+int
+litev_child_add(struct litev_base *base, pid_t pid,
+    void (*cb)(pid_t, int, int, void *), void *udata)
+{
+	struct litev_child	*c;
+	siginfo_t		 si;
+	int			 rc;
+	char			 b;
+
+	if (base == NULL || pid <= 0 || cb == NULL)
+		return (LITEV_EINVAL);
+
+	for (c = base->children; c != NULL; c = c->next) {
+		if (c->pid == pid)
+			return (LITEV_EEXIST);
+	}
+
+	if ((c = mem_malloc(base, sizeof(struct litev_child))) == NULL)
+		return (-1);
+	c->base = base;
+	c->cb = cb;
+	c->udata = udata;
+	c->pid = pid;
+	c->fd = -1;
+
+#ifdef USE_PIDFD
+	if ((rc = child_pidfd(c)) == LITEV_OK)
+		goto link;
+	/* Only kernels before Linux 5.3 fall back to SIGCHLD. */
+	if (rc != -1 || errno != ENOSYS) {
+		mem_free(base, c);
+		return (rc);
+	}
+#endif
+
+	/* Without a pidfd, a child that has been reaped already is unknown. */
+	memset(&si, 0, sizeof(siginfo_t));
+	if (waitid(P_PID, pid, &si, WEXITED | WNOHANG | WNOWAIT) == -1) {
+		mem_free(base, c);
+		return (-1);
+	}
+
+	if ((rc = child_pipe(base)) != LITEV_OK) {
+		mem_free(base, c);
+		return (rc);
+	}
+
+	/* The child may have exited before the handler was installed. */
+	b = 0;
+	while (write(base->sigchld[1], &b, 1) == -1 && errno == EINTR)
+		;
+
+#ifdef USE_PIDFD
+link:
+#endif
+	c->next = base->children;
+	c->prev = &base->children;
+	if (c->next != NULL)
+		c->next->prev = &c->next;
+	base->children = c;
+
+	return (LITEV_OK);
+}
+
+/*
+ * Stop watching the child process pid without reaping it.
+ */
+int
+litev_child_del(struct litev_base *base, pid_t pid)
+{
+	struct litev_child	*c;
+
+	if (base == NULL || pid <= 0)
+		return (LITEV_EINVAL);
+
+	for (c = base->children; c != NULL; c = c->next) {
+		if (c->pid == pid) {
+			child_unlink(c);
+			return (LITEV_OK);
+		}
+	}
+
+	return (LITEV_ENOENT);
+}
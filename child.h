@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2022-2024 Emil Engler <me@emilengler.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef CHILD_H
+#define CHILD_H
+
+/*
+ * A watched child process, whose exit is reported through its pidfd or, if
+ * fd is -1, through the SIGCHLD pipe of the base.  The watchers of a base
+ * are kept in a doubly linked list, so that a reaped child is unlinked in
+ * O(1).
+ */
+struct litev_child {
+	struct litev_child	 *next;
+	struct litev_child	**prev;
+	struct litev_base	 *base;
+	void			(*cb)(pid_t, int, int, void *);
+	void			 *udata;
+	pid_t			  pid;
+	int			  fd;
+};
+
+void	child_free(struct litev_base *);
+
+#endif
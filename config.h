@@ -22,8 +22,41 @@
 #define USE_KQUEUE
 #elif defined(__linux__)
 #define USE_EPOLL
-#else
+#endif
+
+/* poll(2) is available everywhere, either as the default or on request. */
 #define USE_POLL
+
+/* Detect support for accept4(2). */
+#if defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__) || \
+    defined(__linux__)
+#define USE_ACCEPT4
+#endif
+
+/* Detect support for eventfd(2). */
+#if defined(__linux__)
+#define USE_EVENTFD
+#endif
+
+/* Detect support for pidfd_open(2) and waitid(2) with P_PIDFD. */
+#if defined(__linux__)
+#define USE_PIDFD
+#endif
+
+/* Detect support for recvmmsg(2) and sendmmsg(2). */
+#if defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__) || \
+    defined(__linux__)
+#define USE_MMSG
+#endif
+
+/* Detect support for steering connections with SO_ATTACH_REUSEPORT_CBPF. */
+#if defined(__linux__)
+#define USE_REUSEPORT_CBPF
+#endif
+
+/* Detect support for zero-copy transmission with MSG_ZEROCOPY. */
+#if defined(__linux__)
+#define USE_ZEROCOPY
 #endif
 
 #endif
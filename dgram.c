@@ -0,0 +1,557 @@
+/*
+ * Copyright (c) 2022-2024 Emil Engler <me@emilengler.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Required for recvmmsg(2) and sendmmsg(2). */
+#define _GNU_SOURCE
+
+#include "config.h"
+
+#include <sys/types.h>
+
+#include <stdlib.h>
+
+#include "litev.h"
+#include "litev-internal.h"
+#include "mem.h"
+
+#ifdef USE_MMSG
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * The largest payload of a single UDP datagram over IPv4, which also limits
+ * the total size of a segmented send with UDP_SEGMENT.
+ */
+#define GSO_MAX_SIZE	(0xffff - 8 - 20)
+
+/* The maximum amount of segments the kernel accepts for UDP_SEGMENT. */
+#ifndef UDP_MAX_SEGMENTS
+#define UDP_MAX_SEGMENTS	64
+#endif
+
+/* A queued outgoing datagram, whose data lives inside sbuf. */
+struct dgram_out {
+	struct sockaddr_storage	addr;
+	socklen_t		addrlen;
+	size_t			len;
+};
+
+/*
+ * Both sides work on nbatch slots of bufsize bytes each.  Slot i of the
+ * receive side is described by rhdr[i], riov[i] and raddr[i], while slot i
+ * of the send side is described by out[i] and siov[i].  On the send side,
+ * multiple slots may be merged into a single mmsghdr with UDP_SEGMENT, in
+ * which case sfirst[i] is the index of the first slot of shdr[i].
+ */
+struct litev_dgram {
+	struct litev_base	 *base;
+	void			(*cb)(int, struct litev_dgram_msg *, size_t,
+				    void *);
+	void			 *udata;
+	size_t			  nbatch;
+	size_t			  bufsize;
+	size_t			  controllen;
+	int			  fd;
+	int			  has_gro;
+	int			  has_gso;
+	int			  is_reading;
+	int			  is_writing;
+	struct litev_handle	  rhandle;
+	struct litev_handle	  whandle;
+	int			  is_running;
+	int			  is_dead;
+
+	unsigned char		 *rbuf;
+	unsigned char		 *rcontrol;
+	struct mmsghdr		 *rhdr;
+	struct iovec		 *riov;
+	struct sockaddr_storage	 *raddr;
+	struct litev_dgram_msg	 *msgs;
+
+	unsigned char		 *sbuf;
+	unsigned char		 *scontrol;
+	struct mmsghdr		 *shdr;
+	struct iovec		 *siov;
+	struct dgram_out	 *out;
+	size_t			 *sfirst;
+	size_t			  nout;
+};
+
+static void	*dgram_alloc(struct litev_dgram *, size_t);
+static void	 dgram_destroy(struct litev_dgram *);
+static int	 dgram_gro_size(struct msghdr *);
+static int	 dgram_mergeable(struct litev_dgram *, size_t, size_t, size_t);
+static void	 dgram_read_cb(int, short, void *);
+static void	 dgram_write_cb(int, short, void *);
+static int	 dgram_writing(struct litev_dgram *, int);
+
+/*
+ * Allocate an array of one element of size bytes per slot.
+ */
+static void *
+dgram_alloc(struct litev_dgram *d, size_t size)
+{
+	return (mem_reallocarray(d->base, NULL, d->nbatch, size));
+}
+
+static void
+dgram_destroy(struct litev_dgram *d)
+{
+	mem_free(d->base, d->rbuf);
+	mem_free(d->base, d->rcontrol);
+	mem_free(d->base, d->rhdr);
+	mem_free(d->base, d->riov);
+	mem_free(d->base, d->raddr);
+	mem_free(d->base, d->msgs);
+	mem_free(d->base, d->sbuf);
+	mem_free(d->base, d->scontrol);
+	mem_free(d->base, d->shdr);
+	mem_free(d->base, d->siov);
+	mem_free(d->base, d->out);
+	mem_free(d->base, d->sfirst);
+	mem_free(d->base, d);
+}
+
+/*
+ * Return the segment size of a datagram coalesced by UDP_GRO or zero, if
+ * the datagram has not been coalesced.
+ */
+static int
+dgram_gro_size(struct msghdr *msg)
+{
+#ifdef UDP_GRO
+	struct cmsghdr	*cm;
+	int		 size;
+
+	for (cm = CMSG_FIRSTHDR(msg); cm != NULL; cm = CMSG_NXTHDR(msg, cm)) {
+		if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+			memcpy(&size, CMSG_DATA(cm), sizeof(size));
+			return (size);
+		}
+	}
+#endif
+
+	return (0);
+}
+
+/*
+ * Check if slot j can be sent as another segment of the segmented send that
+ * starts at slot i and currently holds total bytes.  All segments must share
+ * the destination and the size, except for the last one, which may be
+ * shorter.
+ */
+static int
+dgram_mergeable(struct litev_dgram *d, size_t i, size_t j, size_t total)
+{
+	if (!d->has_gso || j - i >= UDP_MAX_SEGMENTS)
+		return (0);
+	if (d->out[j - 1].len != d->out[i].len ||
+	    d->out[j].len > d->out[i].len)
+		return (0);
+	if (total + d->out[j].len > GSO_MAX_SIZE)
+		return (0);
+	if (d->out[j].addrlen != d->out[i].addrlen ||
+	    memcmp(&d->out[j].addr, &d->out[i].addr, d->out[i].addrlen) != 0)
+		return (0);
+
+	return (1);
+}
+
+static void
+dgram_read_cb(int fd, short condition, void *udata)
+{
+	struct litev_dgram	*d;
+	struct litev_dgram_msg	*m;
+	struct msghdr		*hdr;
+	size_t			 i, nmsg, off, len, seg;
+	int			 n;
+
+	d = udata;
+
+	for (i = 0; i < d->nbatch; ++i) {
+		hdr = &d->rhdr[i].msg_hdr;
+		hdr->msg_namelen = sizeof(struct sockaddr_storage);
+		hdr->msg_controllen = d->controllen;
+		hdr->msg_flags = 0;
+	}
+
+	/*
+	 * Only receive a single batch per wakeup, so that a flooded socket
+	 * cannot starve the other events of the loop.
+	 */
+	if ((n = recvmmsg(fd, d->rhdr, d->nbatch, MSG_DONTWAIT, NULL)) == -1)
+		return;
+
+	/* The callback may free d, which is deferred until it returns. */
+	d->is_running = 1;
+
+	nmsg = 0;
+	for (i = 0; i < (size_t)n; ++i) {
+		len = d->rhdr[i].msg_len;
+		if ((seg = dgram_gro_size(&d->rhdr[i].msg_hdr)) == 0)
+			seg = len;
+
+		/* Split datagrams that have been coalesced by UDP_GRO. */
+		off = 0;
+		do {
+			if (nmsg == d->nbatch) {
+				d->cb(fd, d->msgs, nmsg, d->udata);
+				if (d->is_dead)
+					goto dead;
+				nmsg = 0;
+			}
+
+			m = &d->msgs[nmsg++];
+			m->buf = d->riov[i].iov_base;
+			m->buf = (unsigned char *)m->buf + off;
+			m->len = len - off < seg ? len - off : seg;
+			m->addr = (struct sockaddr *)&d->raddr[i];
+			m->addrlen = d->rhdr[i].msg_hdr.msg_namelen;
+
+			off += m->len;
+		} while (off < len);
+	}
+
+	if (nmsg > 0) {
+		d->cb(fd, d->msgs, nmsg, d->udata);
+		if (d->is_dead)
+			goto dead;
+	}
+	d->is_running = 0;
+
+	/* Send the replies that have been queued by the callback. */
+	litev_dgram_flush(d);
+	return;
+dead:
+	dgram_destroy(d);
+}
+
+static void
+dgram_write_cb(int fd, short condition, void *udata)
+{
+	litev_dgram_flush(udata);
+}
+
+/*
+ * Register or remove the LITEV_WRITE event, which is only used to flush the
+ * remaining datagrams once the socket buffer has room again.
+ */
+static int
+dgram_writing(struct litev_dgram *d, int is_writing)
+{
+	struct litev_ev	ev;
+	int		rc;
+
+	if (d->is_writing == is_writing)
+		return (LITEV_OK);
+
+	ev.fd = d->fd;
+	ev.condition = LITEV_WRITE;
+	ev.cb = dgram_write_cb;
+	ev.udata = d;
+	if (is_writing)
+		rc = litev_add_handle(d->base, &ev, &d->whandle);
+	else if ((rc = litev_del_handle(d->base, &d->whandle)) ==
+	    LITEV_ENOENT)
+		rc = LITEV_OK;	/* The FD went through litev_close(). */
+	if (rc != LITEV_OK)
+		return (rc);
+
+	d->is_writing = is_writing;
+
+	return (LITEV_OK);
+}
+
+struct litev_dgram *
+litev_dgram_init(struct litev_base *base, int fd, size_t nbatch,
+    size_t bufsize, void (*cb)(int, struct litev_dgram_msg *, size_t, void *),
+    void *udata)
+{
+	struct litev_dgram	*d;
+	struct msghdr		*hdr;
+	struct litev_ev		 ev;
+	socklen_t		 optlen;
+	size_t			 i;
+	int			 opt;
+
+	if (base == NULL || fd < 0 || nbatch == 0 || bufsize == 0 ||
+	    cb == NULL)
+		return (NULL);
+
+	if ((d = mem_malloc(base, sizeof(struct litev_dgram))) == NULL)
+		return (NULL);
+	memset(d, 0, sizeof(struct litev_dgram));
+
+	d->base = base;
+	d->cb = cb;
+	d->udata = udata;
+	d->nbatch = nbatch;
+	d->bufsize = bufsize;
+	d->controllen = CMSG_SPACE(sizeof(int));
+	d->fd = fd;
+
+	d->rbuf = dgram_alloc(d, bufsize);
+	d->rcontrol = dgram_alloc(d, d->controllen);
+	d->rhdr = dgram_alloc(d, sizeof(struct mmsghdr));
+	d->riov = dgram_alloc(d, sizeof(struct iovec));
+	d->raddr = dgram_alloc(d, sizeof(struct sockaddr_storage));
+	d->msgs = dgram_alloc(d, sizeof(struct litev_dgram_msg));
+	if (d->rbuf == NULL || d->rcontrol == NULL || d->rhdr == NULL ||
+	    d->riov == NULL || d->raddr == NULL || d->msgs == NULL)
+		goto err;
+
+	d->sbuf = dgram_alloc(d, bufsize);
+	d->scontrol = dgram_alloc(d, d->controllen);
+	d->shdr = dgram_alloc(d, sizeof(struct mmsghdr));
+	d->siov = dgram_alloc(d, sizeof(struct iovec));
+	d->out = dgram_alloc(d, sizeof(struct dgram_out));
+	d->sfirst = mem_reallocarray(base, NULL, nbatch + 1, sizeof(size_t));
+	if (d->sbuf == NULL || d->scontrol == NULL || d->shdr == NULL ||
+	    d->siov == NULL || d->out == NULL || d->sfirst == NULL)
+		goto err;
+
+	/* The receive side never changes, except for the lengths. */
+	for (i = 0; i < nbatch; ++i) {
+		d->riov[i].iov_base = d->rbuf + i * bufsize;
+		d->riov[i].iov_len = bufsize;
+
+		hdr = &d->rhdr[i].msg_hdr;
+		memset(hdr, 0, sizeof(struct msghdr));
+		hdr->msg_name = &d->raddr[i];
+		hdr->msg_iov = &d->riov[i];
+		hdr->msg_iovlen = 1;
+		hdr->msg_control = d->rcontrol + i * d->controllen;
+	}
+
+	opt = 1;
+#ifdef UDP_GRO
+	/*
+	 * Coalesced datagrams get truncated, if they do not fit into a
+	 * single slot, so GRO is only worth it with maximum sized slots.
+	 */
+	if (bufsize >= 0xffff) {
+		d->has_gro = setsockopt(fd, SOL_UDP, UDP_GRO, &opt,
+		    sizeof(opt)) == 0;
+	}
+#endif
+#ifdef UDP_SEGMENT
+	optlen = sizeof(opt);
+	d->has_gso = getsockopt(fd, SOL_UDP, UDP_SEGMENT, &opt, &optlen) == 0;
+#else
+	(void)optlen;
+#endif
+
+	ev.fd = fd;
+	ev.condition = LITEV_READ;
+	ev.cb = dgram_read_cb;
+	ev.udata = d;
+	if (litev_add_handle(base, &ev, &d->rhandle) != LITEV_OK)
+		goto err;
+	d->is_reading = 1;
+
+	return (d);
+err:
+	litev_dgram_free(&d);
+	return (NULL);
+}
+
+void
+litev_dgram_free(struct litev_dgram **d_ptr)
+{
+	struct litev_dgram	*d;
+
+	if (d_ptr == NULL || *d_ptr == NULL)
+		return;
+	d = *d_ptr;
+
+	/*
+	 * The handles are stale, if the FD has been closed before, in which
+	 * case its number may already belong to another registration.
+	 */
+	if (d->is_reading)
+		litev_del_handle(d->base, &d->rhandle);
+	dgram_writing(d, 0);
+
+	if (d->is_running)
+		d->is_dead = 1;
+	else
+		dgram_destroy(d);
+	*d_ptr = NULL;
+}
+
+int
+litev_dgram_send(struct litev_dgram *d, const void *buf, size_t len,
+    const struct sockaddr *addr, size_t addrlen)
+{
+	struct dgram_out	*o;
+
+	if (d == NULL || (buf == NULL && len > 0))
+		return (LITEV_EINVAL);
+	if (addrlen > sizeof(struct sockaddr_storage) ||
+	    (addr == NULL && addrlen > 0))
+		return (LITEV_EINVAL);
+	if (len > d->bufsize)
+		return (LITEV_EOVERFLOW);
+
+	/* Make room by flushing the queue, if it is full. */
+	if (d->nout == d->nbatch && litev_dgram_flush(d) == -1)
+		return (-1);
+	if (d->nout == d->nbatch)
+		return (LITEV_EAGAIN);
+
+	o = &d->out[d->nout];
+	memcpy(d->sbuf + d->nout * d->bufsize, buf, len);
+	o->len = len;
+	o->addrlen = addrlen;
+	if (addrlen > 0)
+		memcpy(&o->addr, addr, addrlen);
+	++d->nout;
+
+	return (LITEV_OK);
+}
+
+int
+litev_dgram_flush(struct litev_dgram *d)
+{
+	struct msghdr	*hdr;
+	struct cmsghdr	*cm;
+	size_t		 i, j, k, nhdr, total, nsent;
+	uint16_t	 gso;
+	int		 n;
+
+	if (d == NULL)
+		return (LITEV_EINVAL);
+	if (d->nout == 0)
+		return (dgram_writing(d, 0));
+
+again:
+	nhdr = 0;
+	for (i = 0; i < d->nout; i = j) {
+		total = d->out[i].len;
+		for (j = i + 1; j < d->nout && dgram_mergeable(d, i, j, total);
+		    ++j)
+			total += d->out[j].len;
+
+		for (k = i; k < j; ++k) {
+			d->siov[k].iov_base = d->sbuf + k * d->bufsize;
+			d->siov[k].iov_len = d->out[k].len;
+		}
+
+		hdr = &d->shdr[nhdr].msg_hdr;
+		memset(hdr, 0, sizeof(struct msghdr));
+		if (d->out[i].addrlen > 0) {
+			hdr->msg_name = &d->out[i].addr;
+			hdr->msg_namelen = d->out[i].addrlen;
+		}
+		hdr->msg_iov = &d->siov[i];
+		hdr->msg_iovlen = j - i;
+
+#ifdef UDP_SEGMENT
+		/* Let the kernel split the merged slots into datagrams. */
+		if (j - i > 1) {
+			hdr->msg_control = d->scontrol + nhdr * d->controllen;
+			hdr->msg_controllen = CMSG_SPACE(sizeof(gso));
+			memset(hdr->msg_control, 0, d->controllen);
+
+			cm = CMSG_FIRSTHDR(hdr);
+			cm->cmsg_level = SOL_UDP;
+			cm->cmsg_type = UDP_SEGMENT;
+			cm->cmsg_len = CMSG_LEN(sizeof(gso));
+			gso = d->out[i].len;
+			memcpy(CMSG_DATA(cm), &gso, sizeof(gso));
+		}
+#else
+		(void)cm;
+		(void)gso;
+#endif
+
+		d->sfirst[nhdr++] = i;
+	}
+	d->sfirst[nhdr] = d->nout;
+
+	if ((n = sendmmsg(d->fd, d->shdr, nhdr, 0)) == -1) {
+		if ((errno == EIO || errno == EINVAL) && d->has_gso &&
+		    nhdr < d->nout) {
+			/*
+			 * The device cannot offload segmentation or the
+			 * kernel rejects the segmented send.
+			 */
+			d->has_gso = 0;
+			goto again;
+		}
+		if (errno != EAGAIN) {
+			/* Datagrams are unreliable anyway, so drop them. */
+			d->nout = 0;
+			dgram_writing(d, 0);
+			return (-1);
+		}
+		n = 0;
+	}
+
+	/* Move the remaining slots to the front. */
+	nsent = d->sfirst[n];
+	if (nsent > 0 && nsent < d->nout) {
+		memmove(d->out, &d->out[nsent],
+		    sizeof(struct dgram_out) * (d->nout - nsent));
+		memmove(d->sbuf, d->sbuf + nsent * d->bufsize,
+		    d->bufsize * (d->nout - nsent));
+	}
+	d->nout -= nsent;
+
+	/* Wait for the socket to become writable, if it is full. */
+	if (dgram_writing(d, d->nout > 0) != LITEV_OK)
+		return (-1);
+
+	return (d->nout == 0 ? LITEV_OK : LITEV_EAGAIN);
+}
+
+#else
+
+struct litev_dgram *
+litev_dgram_init(struct litev_base *base, int fd, size_t nbatch,
+    size_t bufsize, void (*cb)(int, struct litev_dgram_msg *, size_t, void *),
+    void *udata)
+{
+	return (NULL);
+}
+
+void
+litev_dgram_free(struct litev_dgram **d_ptr)
+{
+}
+
+int
+litev_dgram_send(struct litev_dgram *d, const void *buf, size_t len,
+    const struct sockaddr *addr, size_t addrlen)
+{
+	return (LITEV_ENOTSUP);
+}
+
+int
+litev_dgram_flush(struct litev_dgram *d)
+{
+	return (LITEV_ENOTSUP);
+}
+
+#endif
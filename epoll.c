@@ -31,26 +31,30 @@
 #include "litev-internal.h"
 #include "ev_api.h"
 #include "hash.h"
+#include "mem.h"
 
 #define GROW	128
 
 /* Unfortunately, we cannot name it epoll_data. */
 struct epoll_api_data {
-	struct hash		**hash;
-	struct epoll_event	 *ev;
-	size_t			  nev;
-	size_t			  nactive_ev;
-	int			  epfd;
+	struct litev_base	*base;
+	struct epoll_event	*ev;
+	size_t			 nev;
+	size_t			 nactive_ev;
+	int			 epfd;
 };
 
 static uint32_t		 condition2event(short);
 
-static void		 epoll_cb(struct hash *[], int, short);
+static uint32_t		 epoll_events(struct litev_ev *[], int);
+static void		 epoll_cb(struct epoll_api_data *, int, short);
 static int		 epoll_grow(struct epoll_api_data *);
 
-static EV_API_DATA	*epoll_init(void);
+static EV_API_DATA	*epoll_init(struct litev_base *);
 static void		 epoll_free(EV_API_DATA *);
-static int		 epoll_poll(EV_API_DATA *);
+static int		 epoll_poll(EV_API_DATA *, const struct timespec *);
+static int		 epoll_reinit(EV_API_DATA *);
+static int		 epoll_fd(EV_API_DATA *);
 static int		 epoll_add(EV_API_DATA *, struct litev_ev *);
 static int		 epoll_del(EV_API_DATA *, struct litev_ev *);
 static int		 epoll_close(EV_API_DATA *, int);
@@ -66,32 +70,66 @@ condition2event(short condition)
 		return (EPOLLIN);
 	case LITEV_WRITE:
 		return (EPOLLOUT);
+	case LITEV_ERRQUEUE:
+		return (EPOLLERR);
 	}
 
 	assert(0);
 	return (0);
 }
 
+/*
+ * Calculate the epoll(2) events bitmask of fd from all events that are
+ * registered and enabled with it inside the hash table.
+ */
+static uint32_t
+epoll_events(struct litev_ev *ht[], int fd)
+{
+	struct litev_ev	*node;
+	struct litev_ev	 ev;
+	uint32_t	 events;
+	short		 conditions[] = {
+		LITEV_READ, LITEV_WRITE, LITEV_ERRQUEUE
+	};
+	size_t		 i;
+
+	ev.fd = fd;
+	events = 0;
+
+	for (i = 0; i < sizeof(conditions) / sizeof(conditions[0]); ++i) {
+		ev.condition = conditions[i];
+		node = hash_lookup(ht, &ev);
+		if (node != NULL && node->link.is_enabled)
+			events |= condition2event(conditions[i]);
+	}
+
+	return (events);
+}
+
 /*
  * Lookup an event from the hash table identified by the FD and the condition
  * and execute the accompanying callback function.  See the comment inside
  * epoll_poll() for the motivation behind this approach.
  */
 static void
-epoll_cb(struct hash *ht[], int fd, short condition)
+epoll_cb(struct epoll_api_data *data, int fd, short condition)
 {
-	struct hash	*node;
+	struct litev_ev	*node;
 	struct litev_ev	 ev;
 
 	ev.fd = fd;
 	ev.condition = condition;
 
-	/* Lookup the event and do nothing, if it could not be found. */
-	if ((node = hash_lookup(ht, &ev)) == NULL)
+	/*
+	 * Do nothing, if the event could not be found or has been disabled
+	 * by an earlier callback of this iteration.
+	 */
+	node = hash_lookup(data->base->hash, &ev);
+	if (node == NULL || !node->link.is_enabled)
 		return;
 
 	/* Finally execute the callback. */
-	node->ev.cb(fd, condition, node->ev.udata);
+	ev_cb(data->base, node);
 }
 
 static int
@@ -111,39 +149,39 @@ epoll_grow(struct epoll_api_data *data)
 	if (n_nev > SIZE_MAX / sizeof(struct epoll_event))
 		return (LITEV_EOVERFLOW);
 
-	n_ev = realloc(data->ev, sizeof(struct epoll_event) * n_nev);
+	n_ev = mem_reallocarray(data->base, data->ev, n_nev,
+	    sizeof(struct epoll_event));
 	if (n_ev == NULL)
 		return (-1);
 
 	data->ev = n_ev;
 	data->nev = n_nev;
 
+	++data->base->stats.ngrow;
+	data->base->stats.nbytes_ev += sizeof(struct epoll_event) * GROW;
+
 	return (LITEV_OK);
 }
 
 static EV_API_DATA *
-epoll_init(void)
+epoll_init(struct litev_base *base)
 {
 	struct epoll_api_data	*data;
 
-	if ((data = malloc(sizeof(struct epoll_api_data))) == NULL)
+	if ((data = mem_malloc(base, sizeof(struct epoll_api_data))) == NULL)
 		return (NULL);
+	data->base = base;
 
-	if ((data->hash = hash_init()) == NULL)
-		goto err;
-
-	if ((data->epfd = epoll_create(1)) == -1)
-		goto err;
+	if ((data->epfd = epoll_create(1)) == -1) {
+		mem_free(base, data);
+		return (NULL);
+	}
 
 	data->ev = NULL;
 	data->nev = 0;
 	data->nactive_ev = 0;
 
 	return (data);
-err:
-	hash_free(&data->hash);
-	free(data);
-	return (NULL);
 }
 
 static void
@@ -153,26 +191,39 @@ epoll_free(EV_API_DATA *raw_data)
 
 	data = raw_data;
 
-	hash_free(&data->hash);
-
-	free(data->ev);
+	mem_free(data->base, data->ev);
+	data->base->stats.nbytes_ev -= sizeof(struct epoll_event) * data->nev;
 	close(data->epfd);
 
-	free(data);
+	mem_free(data->base, data);
 }
 
 static int
-epoll_poll(EV_API_DATA *raw_data)
+epoll_poll(EV_API_DATA *raw_data, const struct timespec *timeout)
 {
 	struct epoll_api_data	*data;
+	struct epoll_event	 dummy;
 	int			 nready, i;
 
 	data = raw_data;
 
-	nready = epoll_wait(data->epfd, data->ev, data->nactive_ev, -1);
+	ev_wait(data->base);
+	/*
+	 * data->nev rather than data->nactive_ev, which is zero while all
+	 * events are throttled, but the wait must still last until timeout.
+	 * Without any events ever added, e.g. for a base with timers only,
+	 * the wait uses a dummy, as epoll_wait(2) rejects zero maxevents.
+	 */
+	if (data->nev == 0)
+		nready = epoll_wait(data->epfd, &dummy, 1,
+		    ev_timeout_ms(timeout));
+	else
+		nready = epoll_wait(data->epfd, data->ev, data->nev,
+		    ev_timeout_ms(timeout));
 	if (nready == -1 &&
 	    !(errno == EFAULT || errno == EINTR || errno == EINVAL))
 		return (-1);
+	ev_ready(data->base, nready);
 
 	for (i = 0; i < nready; ++i) {
 		/*
@@ -184,27 +235,77 @@ epoll_poll(EV_API_DATA *raw_data)
 		 * All of this is being done by the epoll_cb() function.
 		 */
 		if (data->ev[i].events & EPOLLIN)
-			epoll_cb(data->hash, data->ev[i].data.fd, LITEV_READ);
+			epoll_cb(data, data->ev[i].data.fd, LITEV_READ);
 		if (data->ev[i].events & EPOLLOUT)
-			epoll_cb(data->hash, data->ev[i].data.fd, LITEV_WRITE);
+			epoll_cb(data, data->ev[i].data.fd, LITEV_WRITE);
+		if (data->ev[i].events & EPOLLERR) {
+			epoll_cb(data, data->ev[i].data.fd,
+			    LITEV_ERRQUEUE);
+		}
 	}
 
 	return (LITEV_OK);
 }
 
 static int
-epoll_add(EV_API_DATA *raw_data, struct litev_ev *ev)
+epoll_reinit(EV_API_DATA *raw_data)
 {
 	struct epoll_api_data	*data;
-	struct hash		*node;
+	struct litev_ev		*node;
 	struct epoll_event	 eev;
-	int			 rc;
+	int			 epfd;
+
+	data = raw_data;
+
+	/*
+	 * The epoll(2) FD is shared with the parent, hence it must not be
+	 * modified.  Closing it only drops the reference of this process.
+	 */
+	if ((epfd = epoll_create(1)) == -1)
+		return (-1);
+	close(data->epfd);
+	data->epfd = epfd;
+
+	/*
+	 * Every FD is added once, through its enabled node with the lowest
+	 * condition, which is also the lowest bit of its events bitmask.
+	 */
+	node = NULL;
+	while ((node = hash_next(data->base->hash, node)) != NULL) {
+		if (!node->link.is_enabled)
+			continue;
+		eev.events = epoll_events(data->base->hash, node->fd);
+		if ((eev.events & -eev.events) !=
+		    condition2event(node->condition))
+			continue;
+		eev.data.fd = node->fd;
+
+		++data->base->stats.nctl;
+		if (epoll_ctl(data->epfd, EPOLL_CTL_ADD, node->fd, &eev) == -1)
+			return (-1);
+	}
+
+	return (LITEV_OK);
+}
+
+static int
+epoll_fd(EV_API_DATA *raw_data)
+{
+	struct epoll_api_data	*data;
 
 	data = raw_data;
 
-	/* Check if the event is already registered. */
-	if (hash_lookup(data->hash, ev) != NULL)
-		return (LITEV_EEXIST);
+	return (data->epfd);
+}
+
+static int
+epoll_add(EV_API_DATA *raw_data, struct litev_ev *node)
+{
+	struct epoll_api_data	*data;
+	struct epoll_event	 eev;
+	int			 rc, op;
+
+	data = raw_data;
 
 	/*
 	 * Grow data->ev, if required.  This step must be done, before
@@ -215,85 +316,49 @@ epoll_add(EV_API_DATA *raw_data, struct litev_ev *ev)
 
 	/*
 	 * Because epoll(2) works on a per-FD basis, rather than on a
-	 * per-event basis, we have to use a very dirty hack here in
-	 * order to register new events.
-	 * It works as follows: Suppose that the application has already
-	 * registered a FD with LITEV_READ and now wants to register the
-	 * same FD with the LITEV_WRITE condition.  What litev will do,
-	 * is try to add the FD with EPOLLOUT through EPOLL_CTL_ADD.
-	 * If this fails with EEXIST, litev will use EPOLL_CTL_MOD and
-	 * OR the event with LITEV_READ.
-	 * This approach makes it hard to add more conditions and should
-	 * be replaced by a better solution, once found.
+	 * per-event basis, the events bitmask of the FD is always
+	 * recalculated from all events that are enabled for it.
+	 * If the FD is not known to epoll(2) yet, it gets added through
+	 * EPOLL_CTL_ADD, otherwise its bitmask is replaced through
+	 * EPOLL_CTL_MOD.
 	 */
-	eev.events = condition2event(ev->condition);
-	eev.data.fd = ev->fd;
-	if (epoll_ctl(data->epfd, EPOLL_CTL_ADD, ev->fd, &eev) == -1) {
-		if (errno != EEXIST)
-			return (-1);
+	eev.events = epoll_events(data->base->hash, node->fd);
+	op = eev.events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+	eev.events |= condition2event(node->condition);
+	eev.data.fd = node->fd;
 
-		eev.events = EPOLLIN | EPOLLOUT;
-		if (epoll_ctl(data->epfd, EPOLL_CTL_MOD, ev->fd, &eev) == -1)
-			return (-1);
-	}
+	++data->base->stats.nctl;
+	if (epoll_ctl(data->epfd, op, node->fd, &eev) == -1)
+		return (-1);
 	++data->nactive_ev;
 
-	/* Add the event to the hash table. */
-	if ((rc = hash_add(data->hash, ev)) != LITEV_OK)
-		goto err;
-
 	return (LITEV_OK);
-err:
-	epoll_ctl(data->epfd, EPOLL_CTL_DEL, ev->fd, &eev);
-	--data->nactive_ev;
-	node = hash_lookup(data->hash, ev);
-	if (node != NULL)
-		hash_del(data->hash, node);
-	return (rc);
 }
 
 static int
-epoll_del(EV_API_DATA *raw_data, struct litev_ev *ev)
+epoll_del(EV_API_DATA *raw_data, struct litev_ev *node)
 {
 	struct epoll_api_data	*data;
-	struct hash		*node;
 	struct epoll_event	 eev;
-	struct litev_ev		 tev;
+	int			 op;
 
 	data = raw_data;
-	eev.data.fd = ev->fd;
-	tev.fd = ev->fd;
 
 	/*
-	 * Because epoll(2) works on a per-FD basis, rather than on a
-	 * per-event basis, we have to use a very dirty hack here in
-	 * order to remove events.
-	 * It works as follows: Suppose that the application has already
-	 * registered two events with the same FD but with two different
-	 * conditions (LITEV_READ | LITEV_WRITE).  Now the application
-	 * wants to remove the event with the LITEV_WRITE condition.
-	 * litev will then remove the entire epoll(2) event and then
-	 * add it again but with recalculated events from the hash table.
+	 * Recalculate the epoll(2) events bitmask of the FD without the
+	 * removed event.  The FD is only removed from epoll(2) entirely,
+	 * once no events are left for it.
 	 */
+	eev.events = epoll_events(data->base->hash, node->fd) &
+	    ~condition2event(node->condition);
+	eev.data.fd = node->fd;
+	op = eev.events == 0 ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
 
-	/* Check if the event is even registered. */
-	if ((node = hash_lookup(data->hash, ev)) == NULL)
-		return (LITEV_ENOENT);
-
-	if (epoll_ctl(data->epfd, EPOLL_CTL_DEL, ev->fd, &eev) == -1)
+	++data->base->stats.nctl;
+	if (epoll_ctl(data->epfd, op, node->fd, &eev) == -1)
 		return (-1);
-	hash_del(data->hash, node);
 	--data->nactive_ev;
 
-	/* Recalculate the epoll(2) events bitmask from the removed event. */
-	/* TODO: Put this into some sort of if/else branching to reduce CPU. */
-	tev.condition = LITEV_READ;
-	if (hash_lookup(data->hash, &tev) != NULL)
-		eev.events = EPOLLIN;
-	tev.condition = LITEV_WRITE;
-	if (hash_lookup(data->hash, &tev) != NULL)
-		eev.events = EPOLLOUT;
-
 	return (LITEV_OK);
 }
 
@@ -301,19 +366,23 @@ static int
 epoll_close(EV_API_DATA *raw_data, int fd)
 {
 	struct epoll_api_data	*data;
-	struct hash		*ev_read, *ev_write;
+	struct litev_ev		*node;
 	struct litev_ev		 ev;
+	short			 conditions[] = {
+		LITEV_READ, LITEV_WRITE, LITEV_ERRQUEUE
+	};
+	size_t			 i;
 
 	data = raw_data;
 	ev.fd = fd;
 
-	/* Fetch all events that contain fd. */
-	ev.condition = LITEV_READ;
-	if ((ev_read = hash_lookup(data->hash, &ev)) != NULL)
-		hash_del(data->hash, ev_read);
-	ev.condition = LITEV_WRITE;
-	if ((ev_write = hash_lookup(data->hash, &ev)) != NULL)
-		hash_del(data->hash, ev_write);
+	/* Account for all enabled events of fd. */
+	for (i = 0; i < sizeof(conditions) / sizeof(conditions[0]); ++i) {
+		ev.condition = conditions[i];
+		node = hash_lookup(data->base->hash, &ev);
+		if (node != NULL && node->link.is_enabled)
+			--data->nactive_ev;
+	}
 
 	/* Closing a fd removes all registered events from epoll(2). */
 	return (close(fd) == 0 ? LITEV_OK : -1);
@@ -322,9 +391,12 @@ epoll_close(EV_API_DATA *raw_data, int fd)
 void
 ev_api_epoll(struct litev_ev_api *ev_api)
 {
+	ev_api->name = "epoll";
 	ev_api->init = epoll_init;
 	ev_api->free = epoll_free;
 	ev_api->poll = epoll_poll;
+	ev_api->reinit = epoll_reinit;
+	ev_api->fd = epoll_fd;
 	ev_api->add = epoll_add;
 	ev_api->del = epoll_del;
 	ev_api->close = epoll_close;
@@ -17,12 +17,15 @@
 #ifndef EV_API_H
 #define EV_API_H
 
-#if defined(USE_KQUEUE)
+#ifdef USE_KQUEUE
 void	ev_api_kqueue(struct litev_ev_api *);
-#elif defined(USE_EPOLL)
+#endif
+#ifdef USE_EPOLL
 void	ev_api_epoll(struct litev_ev_api *);
-#elif defined(USE_POLL)
+#endif
+#ifdef USE_POLL
 void	ev_api_poll(struct litev_ev_api *);
 #endif
+void	ev_api_null(struct litev_ev_api *);
 
 #endif
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2022-2024 Emil Engler <me@emilengler.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Embedding of a litev base inside another event loop, which is a second
+ * litev base here, but could be any loop that watches FDs for reading.
+ * The inner base echoes the lines of stdin and is only serviced when the
+ * FD of its backend becomes readable.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <signal.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <litev.h>
+
+static void	inner_cb(int, short, void *);
+static void	outer_cb(int, short, void *);
+static void	sighdlr(int);
+
+static struct litev_base	*inner, *outer;
+
+static void
+sighdlr(int sig)
+{
+	switch (sig) {
+	case SIGINT:	/* FALLTHROUGH */
+	case SIGTERM:
+		if (litev_break(outer) != LITEV_OK)
+			errx(1, "litev_break");
+	}
+}
+
+/*
+ * The callback of the inner base, for the lines of stdin.
+ */
+static void
+inner_cb(int fd, short condition, void *unused)
+{
+	char	buf[128];
+	ssize_t	n;
+
+	if ((n = read(fd, buf, sizeof(buf))) <= 0) {
+		litev_break(outer);
+		return;
+	}
+	fwrite(buf, 1, n, stdout);
+	fflush(stdout);
+}
+
+/*
+ * The callback of the outer loop, which processes the events that are ready
+ * inside the inner base without blocking.
+ */
+static void
+outer_cb(int fd, short condition, void *unused)
+{
+	if (litev_loop(inner, LITEV_NOWAIT) != LITEV_OK)
+		errx(1, "litev_loop");
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct litev_ev	ev;
+	int		fd;
+
+	signal(SIGINT, sighdlr);
+	signal(SIGTERM, sighdlr);
+
+	if ((inner = litev_init()) == NULL)
+		errx(1, "litev_init");
+	if ((outer = litev_init()) == NULL)
+		errx(1, "litev_init");
+
+	/* poll(2) has no FD that could be watched. */
+	if ((fd = litev_backend_fd(inner)) == -1)
+		errx(1, "%s cannot be embedded", litev_backend_name(inner));
+
+	ev.fd = STDIN_FILENO;
+	ev.condition = LITEV_READ;
+	ev.cb = inner_cb;
+	ev.udata = NULL;
+	if (litev_add(inner, &ev) != LITEV_OK)
+		errx(1, "litev_add");
+
+	ev.fd = fd;
+	ev.cb = outer_cb;
+	if (litev_add(outer, &ev) != LITEV_OK)
+		errx(1, "litev_add");
+
+	if (litev_dispatch(outer) != LITEV_OK)
+		errx(1, "litev_dispatch");
+
+	litev_free(&outer);
+	litev_free(&inner);
+
+	return (0);
+}
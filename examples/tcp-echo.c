@@ -38,39 +38,23 @@
 
 #define PORT	8080
 
-static void	accept_cb(int, short, void *);
+static void	accept_err_cb(int, int, void *);
 static void	client_cb(int, short, void *);
 static int	create_socket(void);
 static void	sighdlr(int);
 
 static struct litev_base	*base;
+static int			 server;
 
 /*
- * The callback for incoming connections.
+ * The callback for a server socket that has stopped accepting connections,
+ * because we ran out of FDs.
  */
 static void
-accept_cb(int s, short condition, void *unused)
+accept_err_cb(int fd, int error, void *unused)
 {
-	struct litev_ev	ev;
-	int		c;
-
-	assert(condition == LITEV_READ);
-
-	/* Accept the incoming connection. */
-	if ((c = accept(s, NULL, NULL)) == -1) {
-		if (errno == EAGAIN)
-			return;
-		else
-			err(1, "accept");
-	}
-
-	/* Add the new connection to the event loop. */
-	ev.fd = c;
-	ev.condition = LITEV_READ;
-	ev.cb = client_cb;
-	ev.udata = NULL;
-	if (litev_add(base, &ev) != LITEV_OK)
-		errx(1, "litev_add client");
+	errno = error;
+	warn("accept");
 }
 
 /*
@@ -92,6 +76,9 @@ client_cb(int c, short condition, void *unused)
 		err(1, "recv");
 	else if (n == 0) {	/* Client closed the connection. */
 		litev_close(base, c);
+
+		/* Accept connections again, if we ran out of FDs. */
+		litev_listener_resume(base, server);
 	} else
 		send(c, buf, 129, 0);
 }
@@ -141,8 +128,7 @@ sighdlr(int sig)
 int
 main(int argc, char *argv[])
 {
-	struct litev_ev	ev;
-	int		s;
+	struct litev_listener_opts	opts;
 
 	signal(SIGINT, sighdlr);
 	signal(SIGTERM, sighdlr);
@@ -152,15 +138,18 @@ main(int argc, char *argv[])
 		errx(1, "litev_init");
 
 	/* Create the server socket. */
-	s = create_socket();
-
-	/* Add the server socket to the event loop. */
-	ev.fd = s;
-	ev.condition = LITEV_READ;
-	ev.cb = accept_cb;
-	ev.udata = NULL;
-	if (litev_add(base, &ev) != LITEV_OK)
-		errx(1, "litev_add master");
+	server = create_socket();
+
+	/*
+	 * Add the server socket to the event loop.  Incoming connections are
+	 * accepted as non-blocking sockets and added with client_cb().
+	 */
+	opts.budget = 0;
+	opts.cb = client_cb;
+	opts.udata = NULL;
+	opts.err_cb = accept_err_cb;
+	if (litev_listener_add(base, server, NULL, &opts) != LITEV_OK)
+		errx(1, "litev_listener_add");
 
 	puts("Ready for incoming connections");
 	/* Launch the event loop. */
@@ -170,7 +159,7 @@ main(int argc, char *argv[])
 
 	/* Clean everything up. */
 	litev_free(&base);
-	close(s);
+	close(server);
 
 	return (0);
 }
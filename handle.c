@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2022-2024 Emil Engler <me@emilengler.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "litev.h"
+#include "litev-internal.h"
+#include "handle.h"
+#include "hash.h"
+#include "mem.h"
+#include "ratelimit.h"
+
+#define GROW	64
+
+static int	handle_grow(struct litev_base *);
+
+/*
+ * Grow the handle table by GROW slots, which are put onto the free list.
+ */
+static int
+handle_grow(struct litev_base *base)
+{
+	struct handle_slot	*n_handles;
+	size_t			 n_nhandle, i;
+
+	/* Slot 0 is reserved, hence the table starts with GROW + 1 slots. */
+	n_nhandle = base->nhandle == 0 ? GROW + 1 : base->nhandle + GROW;
+	if (n_nhandle > UINT32_MAX)
+		return (LITEV_EOVERFLOW);
+
+	n_handles = mem_reallocarray(base, base->handles, n_nhandle,
+	    sizeof(struct handle_slot));
+	if (n_handles == NULL)
+		return (-1);
+
+	for (i = base->nhandle == 0 ? 1 : base->nhandle; i < n_nhandle; ++i) {
+		n_handles[i].node = NULL;
+		n_handles[i].gen = 1;
+		n_handles[i].next = i + 1 < n_nhandle ? i + 1 : 0;
+	}
+	base->free_handle = base->nhandle == 0 ? 1 : base->nhandle;
+	base->handles = n_handles;
+	base->nhandle = n_nhandle;
+
+	return (LITEV_OK);
+}
+
+/*
+ * Assign a handle to node and store it in handle.
+ */
+int
+handle_new(struct litev_base *base, struct litev_ev *node,
+    struct litev_handle *handle)
+{
+	unsigned int	idx;
+	int		rc;
+
+	if (base->free_handle == 0 && (rc = handle_grow(base)) != LITEV_OK)
+		return (rc);
+
+	idx = base->free_handle;
+	base->free_handle = base->handles[idx].next;
+	base->handles[idx].node = node;
+	node->link.handle = idx;
+
+	handle->idx = idx;
+	handle->gen = base->handles[idx].gen;
+
+	return (LITEV_OK);
+}
+
+/*
+ * Return the node of handle, or NULL if the handle is invalid or stale.
+ */
+struct litev_ev *
+handle_get(struct litev_base *base, const struct litev_handle *handle)
+{
+	if (handle->idx == 0 || handle->idx >= base->nhandle ||
+	    base->handles[handle->idx].gen != handle->gen)
+		return (NULL);
+
+	return (base->handles[handle->idx].node);
+}
+
+void
+handle_release(struct litev_base *base, unsigned int idx)
+{
+	base->handles[idx].node = NULL;
+
+	/* 0 is never a valid generation. */
+	if (++base->handles[idx].gen == 0)
+		base->handles[idx].gen = 1;
+
+	base->handles[idx].next = base->free_handle;
+	base->free_handle = idx;
+}
+
+void
+handle_free(struct litev_base *base)
+{
+	mem_free(base, base->handles);
+	base->handles = NULL;
+	base->nhandle = 0;
+	base->free_handle = 0;
+}
+
+int
+litev_add_handle(struct litev_base *base, struct litev_ev *ev,
+    struct litev_handle *handle)
+{
+	struct litev_ev	*node;
+	int		 rc;
+
+	if (handle == NULL)
+		return (LITEV_EINVAL);
+	if ((rc = litev_add(base, ev)) != LITEV_OK)
+		return (rc);
+
+	node = hash_lookup(base->hash, ev);
+	if ((rc = handle_new(base, node, handle)) != LITEV_OK)
+		ev_del(base, node);
+
+	return (rc);
+}
+
+int
+litev_del_handle(struct litev_base *base, const struct litev_handle *handle)
+{
+	struct litev_ev	*node;
+
+	if (base == NULL || handle == NULL)
+		return (LITEV_EINVAL);
+	if ((node = handle_get(base, handle)) == NULL)
+		return (LITEV_ENOENT);
+
+	TRACE(base, LITEV_TRACE_DEL, node->fd, node->condition);
+
+	return (ev_del(base, node));
+}
+
+/*
+ * Replace the callback and udata of a registered event.  The kernel is not
+ * involved in this at all.
+ */
+int
+litev_modify_handle(struct litev_base *base, const struct litev_handle *handle,
+    void (*cb)(int, short, void *), void *udata)
+{
+	struct litev_ev	*node;
+
+	if (base == NULL || handle == NULL || cb == NULL)
+		return (LITEV_EINVAL);
+	if ((node = handle_get(base, handle)) == NULL)
+		return (LITEV_ENOENT);
+
+	node->cb = cb;
+	node->udata = udata;
+
+	return (LITEV_OK);
+}
+
+int
+litev_enable(struct litev_base *base, const struct litev_handle *handle)
+{
+	struct litev_ev	*node;
+	int		 rc;
+
+	if (base == NULL || handle == NULL)
+		return (LITEV_EINVAL);
+	if ((node = handle_get(base, handle)) == NULL)
+		return (LITEV_ENOENT);
+	if (node->link.is_enabled || node->link.is_throttled)
+		return (LITEV_EALREADY);
+
+	/* The rate limit enables the event, once its bucket is refilled. */
+	if (rl_is_suspended(base, node->fd, node->condition)) {
+		node->link.is_throttled = 1;
+		return (LITEV_OK);
+	}
+
+	if ((rc = base->ev_api.add(base->ev_api_data, node)) != LITEV_OK)
+		return (rc);
+	node->link.is_enabled = 1;
+
+	return (LITEV_OK);
+}
+
+/*
+ * Stop the event from being reported, while keeping it registered, so that
+ * it can be enabled again through its handle.
+ */
+int
+litev_disable(struct litev_base *base, const struct litev_handle *handle)
+{
+	struct litev_ev	*node;
+	int		 rc;
+
+	if (base == NULL || handle == NULL)
+		return (LITEV_EINVAL);
+	if ((node = handle_get(base, handle)) == NULL)
+		return (LITEV_ENOENT);
+
+	/* Keep the rate limit from enabling a throttled event again. */
+	if (node->link.is_throttled) {
+		node->link.is_throttled = 0;
+		return (LITEV_OK);
+	}
+	if (!node->link.is_enabled)
+		return (LITEV_EALREADY);
+
+	if ((rc = base->ev_api.del(base->ev_api_data, node)) != LITEV_OK)
+		return (rc);
+	node->link.is_enabled = 0;
+
+	return (LITEV_OK);
+}
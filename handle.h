@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2022-2024 Emil Engler <me@emilengler.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef HANDLE_H
+#define HANDLE_H
+
+/*
+ * A slot of the handle table.  gen is incremented whenever the slot is
+ * released, so that handles to a former node of it become stale.  Free
+ * slots are linked through next, slot 0 is never used.
+ */
+struct handle_slot {
+	struct litev_ev	*node;
+	unsigned int	 gen;
+	unsigned int	 next;
+};
+
+int		 handle_new(struct litev_base *, struct litev_ev *,
+		    struct litev_handle *);
+struct litev_ev	*handle_get(struct litev_base *, const struct litev_handle *);
+void		 handle_release(struct litev_base *, unsigned int);
+void		 handle_free(struct litev_base *);
+
+#endif
@@ -23,7 +23,9 @@
 
 #include "litev.h"
 #include "litev-internal.h"
+#include "handle.h"
 #include "hash.h"
+#include "mem.h"
 
 /* Amount of slots in the hash table array. */
 #define NHASH	128
@@ -31,98 +33,153 @@
 /* The hashing function. */
 #define HASH(x)	(x % NHASH)
 
-struct hash **
-hash_init(void)
+struct litev_ev **
+hash_init(struct litev_base *base)
 {
-	struct hash	**ht;
+	struct litev_ev	**ht;
 
 	/* Allocate the hash table array and initialize it to NULL. */
-	if ((ht = malloc(sizeof(struct hash *) * NHASH)) == NULL)
+	if ((ht = mem_malloc(base, sizeof(struct litev_ev *) * NHASH)) == NULL)
 		return (NULL);
-	memset(ht, 0, sizeof(struct hash *) * NHASH);
+	memset(ht, 0, sizeof(struct litev_ev *) * NHASH);
+	base->stats.nbytes_hash += sizeof(struct litev_ev *) * NHASH;
 
 	return (ht);
 }
 
 void
-hash_free(struct hash ***ht_ptr)
+hash_free(struct litev_base *base, struct litev_ev ***ht_ptr)
 {
-	struct hash	**ht, *tmp;
+	struct litev_ev	**ht, *tmp;
 	int		  i;
 
-	ht = *ht_ptr;
+	if ((ht = *ht_ptr) == NULL)
+		return;
 
-	/* Free all linked lists. */
+	/* Free all linked lists, intrusive nodes belong to the caller. */
 	for (i = 0; i < NHASH; ++i) {
 		while (ht[i] != NULL) {
 			tmp = ht[i];
-			ht[i] = ht[i]->next;
-			free(tmp);
+			ht[i] = ht[i]->link.next;
+			if (tmp->link.is_intrusive) {
+				tmp->link.is_intrusive = 0;
+				continue;
+			}
+			mem_free(base, tmp);
+			base->stats.nbytes_hash -= sizeof(struct litev_ev);
 		}
 	}
 
-	free(ht);
+	mem_free(base, ht);
+	base->stats.nbytes_hash -= sizeof(struct litev_ev *) * NHASH;
 	*ht_ptr = NULL;
 }
 
-struct hash *
-hash_lookup(struct hash *ht[], struct litev_ev *ev)
+struct litev_ev *
+hash_lookup(struct litev_ev *ht[], struct litev_ev *ev)
 {
-	struct hash	*node;
+	struct litev_ev	*node;
 
-	for (node = ht[HASH(ev->fd)]; node != NULL; node = node->next) {
+	for (node = ht[HASH(ev->fd)]; node != NULL; node = node->link.next) {
 		/*
 		 * Nodes are identified by the unique combination of the FD
 		 * and the condition.
 		 */
-		if (node->ev.fd == ev->fd &&
-		    node->ev.condition == ev->condition)
+		if (node->fd == ev->fd && node->condition == ev->condition)
 			break;
 	}
 
 	return (node);
 }
 
-int
-hash_add(struct hash *ht[], struct litev_ev *ev)
+/*
+ * Return the node after node in the order of the hash table, or the first
+ * node if node is NULL.
+ */
+struct litev_ev *
+hash_next(struct litev_ev *ht[], struct litev_ev *node)
+{
+	int	slot;
+
+	if (node != NULL && node->link.next != NULL)
+		return (node->link.next);
+
+	for (slot = node != NULL ? HASH(node->fd) + 1 : 0; slot < NHASH;
+	    ++slot) {
+		if (ht[slot] != NULL)
+			return (ht[slot]);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Add a disabled node for ev and return it, or NULL if it could not be
+ * allocated.  If is_intrusive is set, ev itself becomes the node.
+ */
+struct litev_ev *
+hash_add(struct litev_base *base, struct litev_ev *ht[], struct litev_ev *ev,
+    int is_intrusive)
 {
-	struct hash	*node;
+	struct litev_ev	*node;
 	int		 slot;
 
 	slot = HASH(ev->fd);
 
-	/* Allocate a new node and copy ev into it. */
-	if ((node = malloc(sizeof(struct hash))) == NULL)
-		return (-1);
-	memcpy(&node->ev, ev, sizeof(struct litev_ev));
+	/* Allocate a new node and copy ev into it, unless it is intrusive. */
+	if (is_intrusive)
+		node = ev;
+	else {
+		if ((node = mem_malloc(base, sizeof(struct litev_ev))) == NULL)
+			return (NULL);
+		memcpy(node, ev, sizeof(struct litev_ev));
+		base->stats.nbytes_hash += sizeof(struct litev_ev);
+	}
+	node->link.idx = 0;
+	node->link.handle = 0;
+	node->link.is_enabled = 0;
+	node->link.is_intrusive = is_intrusive;
+	node->link.is_throttled = 0;
 
 	/* Insert the new node at the beginning of the linked list. */
-	node->prev = NULL;
-	node->next = ht[slot];
-	if (node->next != NULL)
-		node->next->prev = node;
+	node->link.prev = NULL;
+	node->link.next = ht[slot];
+	if (node->link.next != NULL)
+		node->link.next->link.prev = node;
 	ht[slot] = node;
 
-	return (LITEV_OK);
+	return (node);
 }
 
 void
-hash_del(struct hash *ht[], struct hash *node)
+hash_del(struct litev_base *base, struct litev_ev *ht[], struct litev_ev *node)
 {
 	int	slot;
 
-	slot = HASH(node->ev.fd);
+	slot = HASH(node->fd);
 
 	/* Remove node from the linked list. */
 	/* node is the head node. */
-	if (node->prev == NULL) {
-		if (node->next != NULL)
-			node->next->prev = NULL;
-		ht[slot] = node->next;
+	if (node->link.prev == NULL) {
+		if (node->link.next != NULL)
+			node->link.next->link.prev = NULL;
+		ht[slot] = node->link.next;
 	} else {
-		if (node->next != NULL)
-			node->next->prev = node->prev;
-		node->prev->next = node->next;
+		if (node->link.next != NULL)
+			node->link.next->link.prev = node->link.prev;
+		node->link.prev->link.next = node->link.next;
 	}
-	free(node);
+
+	/* Outstanding handles of node become stale. */
+	if (node->link.handle != 0)
+		handle_release(base, node->link.handle);
+
+	/* The caller may reuse or free an intrusive node from now on. */
+	if (node->link.is_intrusive) {
+		node->link.is_intrusive = 0;
+		return;
+	}
+
+	mem_free(base, node);
+	base->stats.nbytes_hash -= sizeof(struct litev_ev);
 }
@@ -18,20 +18,22 @@
 #define HASH_H
 
 /*
- * TODO: Document how the hash table works.
+ * Every registered event is a node inside the hash table of its base,
+ * identified by the combination of its FD and condition and chained through
+ * its link.  The node is either a copy of the event that was passed to
+ * litev_add() or, if it is intrusive, the event of the caller itself.  The
+ * backends only keep the kernel informed about the nodes that are enabled.
+ * A node stays at the same address for as long as it is registered.
  */
-struct hash {
-	struct hash	*prev;
-	struct hash	*next;
-	struct litev_ev  ev;
-};
+struct litev_ev	**hash_init(struct litev_base *);
+void		  hash_free(struct litev_base *, struct litev_ev ***);
 
-struct hash	**hash_init(void);
-void		  hash_free(struct hash ***);
+struct litev_ev	 *hash_lookup(struct litev_ev *[], struct litev_ev *);
+struct litev_ev	 *hash_next(struct litev_ev *[], struct litev_ev *);
 
-struct hash	 *hash_lookup(struct hash *[], struct litev_ev *);
-
-int		  hash_add(struct hash *[], struct litev_ev *);
-void		  hash_del(struct hash *[], struct hash *);
+struct litev_ev	 *hash_add(struct litev_base *, struct litev_ev *[],
+		      struct litev_ev *, int);
+void		  hash_del(struct litev_base *, struct litev_ev *[],
+		      struct litev_ev *);
 
 #endif
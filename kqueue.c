@@ -32,23 +32,27 @@
 #include "litev-internal.h"
 #include "ev_api.h"
 #include "hash.h"
+#include "mem.h"
 
 #define GROW	128
 
 struct kqueue_data {
-	struct hash	**hash;
-	struct kevent	 *ev;
-	size_t		  nev;
-	size_t		  nactive_ev;
-	int		  kq;
+	struct litev_base	*base;
+	struct kevent		*ev;
+	size_t			 nev;
+	size_t			 nactive_ev;
+	int			 kq;
 };
 
 static short		 condition2filter(short);
+static short		 filter2condition(short);
 
 static int		 kqueue_grow(struct kqueue_data *);
-static EV_API_DATA	*kqueue_init(void);
+static EV_API_DATA	*kqueue_init(struct litev_base *);
 static void		 kqueue_free(EV_API_DATA *);
-static int		 kqueue_poll(EV_API_DATA *);
+static int		 kqueue_poll(EV_API_DATA *, const struct timespec *);
+static int		 kqueue_reinit(EV_API_DATA *);
+static int		 kqueue_fd(EV_API_DATA *);
 static int		 kqueue_add(EV_API_DATA *, struct litev_ev *);
 static int		 kqueue_del(EV_API_DATA *, struct litev_ev *);
 static int		 kqueue_close(EV_API_DATA *, int);
@@ -67,6 +71,20 @@ condition2filter(short condition)
 	return (0);
 }
 
+static short
+filter2condition(short filter)
+{
+	switch (filter) {
+	case EVFILT_READ:
+		return (LITEV_READ);
+	case EVFILT_WRITE:
+		return (LITEV_WRITE);
+	}
+
+	assert(0);
+	return (0);
+}
+
 static int
 kqueue_grow(struct kqueue_data *data)
 {
@@ -84,38 +102,39 @@ kqueue_grow(struct kqueue_data *data)
 	if (n_nev > SIZE_MAX / sizeof(struct kevent))
 		return (LITEV_EOVERFLOW);
 
-	if ((n_ev = realloc(data->ev, sizeof(struct kevent) * n_nev)) == NULL)
+	n_ev = mem_reallocarray(data->base, data->ev, n_nev,
+	    sizeof(struct kevent));
+	if (n_ev == NULL)
 		return (-1);
 
 	data->ev = n_ev;
 	data->nev = n_nev;
 
+	++data->base->stats.ngrow;
+	data->base->stats.nbytes_ev += sizeof(struct kevent) * GROW;
+
 	return (LITEV_OK);
 }
 
 static EV_API_DATA *
-kqueue_init(void)
+kqueue_init(struct litev_base *base)
 {
 	struct kqueue_data	*data;
 
-	if ((data = malloc(sizeof(struct kqueue_data))) == NULL)
+	if ((data = mem_malloc(base, sizeof(struct kqueue_data))) == NULL)
 		return (NULL);
+	data->base = base;
 
-	if ((data->hash = hash_init()) == NULL)
-		goto err;
-
-	if ((data->kq = kqueue()) == -1)
-		goto err;
+	if ((data->kq = kqueue()) == -1) {
+		mem_free(base, data);
+		return (NULL);
+	}
 
 	data->ev = NULL;
 	data->nev = 0;
 	data->nactive_ev = 0;
 
 	return (data);
-err:
-	hash_free(&data->hash);
-	free(data);
-	return (NULL);
 }
 
 static void
@@ -125,106 +144,148 @@ kqueue_free(EV_API_DATA *raw_data)
 
 	data = raw_data;
 
-	hash_free(&data->hash);
-
-	free(data->ev);
+	mem_free(data->base, data->ev);
+	data->base->stats.nbytes_ev -= sizeof(struct kevent) * data->nev;
 	close(data->kq);
 
-	free(data);
+	mem_free(data->base, data);
 }
 
 static int
-kqueue_poll(EV_API_DATA *raw_data)
+kqueue_poll(EV_API_DATA *raw_data, const struct timespec *timeout)
 {
 	struct kqueue_data	*data;
-	struct litev_ev		*ev;
+	struct litev_ev		*node;
+	struct litev_ev		 ev;
+	struct kevent		 dummy;
 	int			 nready, i;
 
 	data = raw_data;
 
-	nready = kevent(data->kq, NULL, 0, data->ev, data->nactive_ev, NULL);
+	ev_wait(data->base);
+	/*
+	 * See epoll_poll() for why data->nev and the dummy are used.
+	 * kevent(2) does not wait at all with zero nevents.
+	 */
+	if (data->nev == 0)
+		nready = kevent(data->kq, NULL, 0, &dummy, 1, timeout);
+	else
+		nready = kevent(data->kq, NULL, 0, data->ev, data->nev,
+		    timeout);
 	if (nready == -1 && errno != EINTR)
 		return (-1);
+	ev_ready(data->base, nready);
 
 	for (i = 0; i < nready; ++i) {
 		/*
-		 * Because kqueue(2)s udata field is set to the
-		 * struct litev_ev of the appropriate hash table entry, we do
-		 * not need to perform an additional lookup inside the hash
-		 * table.
+		 * The udata field of kqueue(2) cannot be trusted here, as an
+		 * earlier callback of this iteration may have removed the
+		 * node it points to.  Hence, look up the event again and do
+		 * nothing, if it is gone or has been disabled, just like
+		 * epoll_cb() does.
 		 */
-		ev = data->ev[i].udata;
-		ev->cb(ev->fd, ev->condition, ev->udata);
+		ev.fd = data->ev[i].ident;
+		ev.condition = filter2condition(data->ev[i].filter);
+		node = hash_lookup(data->base->hash, &ev);
+		if (node == NULL || !node->link.is_enabled)
+			continue;
+		ev_cb(data->base, node);
 	}
 
 	return (LITEV_OK);
 }
 
 static int
-kqueue_add(EV_API_DATA *raw_data, struct litev_ev *ev)
+kqueue_reinit(EV_API_DATA *raw_data)
+{
+	struct kqueue_data	*data;
+	struct litev_ev		*node;
+	struct kevent		 kev;
+	int			 kq;
+
+	data = raw_data;
+
+	/*
+	 * A kqueue(2) is not inherited by fork(2), hence data->kq must not be
+	 * closed, as its number may belong to another FD of the child by now.
+	 */
+	if ((kq = kqueue()) == -1)
+		return (-1);
+	data->kq = kq;
+
+	node = NULL;
+	while ((node = hash_next(data->base->hash, node)) != NULL) {
+		if (!node->link.is_enabled)
+			continue;
+		EV_SET(&kev, node->fd, condition2filter(node->condition),
+		    EV_ADD, 0, 0, node);
+
+		++data->base->stats.nctl;
+		if (kevent(data->kq, &kev, 1, NULL, 0, NULL) == -1)
+			return (-1);
+	}
+
+	return (LITEV_OK);
+}
+
+static int
+kqueue_fd(EV_API_DATA *raw_data)
+{
+	struct kqueue_data	*data;
+
+	data = raw_data;
+
+	return (data->kq);
+}
+
+static int
+kqueue_add(EV_API_DATA *raw_data, struct litev_ev *node)
 {
 	struct kqueue_data	*data;
-	struct hash		*node;
 	struct kevent		 kev;
 	short			 filter;
 	int			 rc;
 
 	data = raw_data;
 
-	/* Check if the event is already registered. */
-	if (hash_lookup(data->hash, ev) != NULL)
-		return (LITEV_EEXIST);
+	/* kqueue(2) has no notion of a socket error queue. */
+	if (node->condition == LITEV_ERRQUEUE)
+		return (LITEV_ENOTSUP);
 
 	/* Grow data->ev, if required. */
 	if ((rc = kqueue_grow(data)) != LITEV_OK)
 		return (rc);
 
-	/* Add the event to the hash table. */
-	if ((rc = hash_add(data->hash, ev)) != LITEV_OK)
-		return (rc);
-
-	/* Obtain the now added node, so we can add it to kqueue(2)s udata. */
-	node = hash_lookup(data->hash, ev);
-	assert(node != NULL);
-
 	/* Convert the event to a kqueue(2) event. */
-	filter = condition2filter(ev->condition);
-	EV_SET(&kev, ev->fd, filter, EV_ADD, 0, 0, &node->ev);
+	filter = condition2filter(node->condition);
+	EV_SET(&kev, node->fd, filter, EV_ADD, 0, 0, node);
 
 	/* Add the event to kqueue(2). */
-	if (kevent(data->kq, &kev, 1, NULL, 0, NULL) == -1) {
-		/* Failure during event registration. */
-		hash_del(data->hash, node);
+	++data->base->stats.nctl;
+	if (kevent(data->kq, &kev, 1, NULL, 0, NULL) == -1)
 		return (-1);
-	}
 	++data->nactive_ev;
 
 	return (LITEV_OK);
 }
 
 static int
-kqueue_del(EV_API_DATA *raw_data, struct litev_ev *ev)
+kqueue_del(EV_API_DATA *raw_data, struct litev_ev *node)
 {
 	struct kqueue_data	*data;
-	struct hash		*node;
 	struct kevent		 kev;
 	short			 filter;
 
 	data = raw_data;
 
-	/* Check if the event is even registered. */
-	if ((node = hash_lookup(data->hash, ev)) == NULL)
-		return (LITEV_ENOENT);
-
 	/* Convert the event to a kqueue(2) removal event. */
-	filter = condition2filter(ev->condition);
-	EV_SET(&kev, ev->fd, filter, EV_DELETE, 0, 0, NULL);
+	filter = condition2filter(node->condition);
+	EV_SET(&kev, node->fd, filter, EV_DELETE, 0, 0, NULL);
 
 	/* Remove the event from kqueue(2). */
+	++data->base->stats.nctl;
 	if (kevent(data->kq, &kev, 1, NULL, 0, NULL) == -1)
 		return (-1);
-
-	hash_del(data->hash, node);
 	--data->nactive_ev;
 
 	return (LITEV_OK);
@@ -234,21 +295,26 @@ static int
 kqueue_close(EV_API_DATA *raw_data, int fd)
 {
 	struct kqueue_data	*data;
+	struct litev_ev		*node;
 	struct litev_ev		 ev;
+	short			 conditions[] = { LITEV_READ, LITEV_WRITE };
+	size_t			 i;
 
 	data = raw_data;
 	ev.fd = fd;
 
-	/* Remove all events that contain FD. */
 	/*
-	 * We do not check for the result of kqueue_del() because it may either
-	 * be LITEV_ENONET, in which case it does not matter anyway, or -1, in
-	 * which we will inevitably leak memory.
+	 * Remove all enabled events of fd.  We do not check for the result
+	 * of kqueue_del(), because closing the FD removes the events from
+	 * kqueue(2) anyway.
 	 */
-	ev.condition = LITEV_READ;
-	kqueue_del(data, &ev);
-	ev.condition = LITEV_WRITE;
-	kqueue_del(data, &ev);
+	for (i = 0; i < sizeof(conditions) / sizeof(conditions[0]); ++i) {
+		ev.condition = conditions[i];
+		node = hash_lookup(data->base->hash, &ev);
+		if (node != NULL && node->link.is_enabled &&
+		    kqueue_del(data, node) != LITEV_OK)
+			--data->nactive_ev;
+	}
 
 	/* Closing a fd removes all registered events from kqueue(2). */
 	return (close(fd) == 0 ? LITEV_OK : -1);
@@ -257,9 +323,12 @@ kqueue_close(EV_API_DATA *raw_data, int fd)
 void
 ev_api_kqueue(struct litev_ev_api *ev_api)
 {
+	ev_api->name = "kqueue";
 	ev_api->init = kqueue_init;
 	ev_api->free = kqueue_free;
 	ev_api->poll = kqueue_poll;
+	ev_api->reinit = kqueue_reinit;
+	ev_api->fd = kqueue_fd;
 	ev_api->add = kqueue_add;
 	ev_api->del = kqueue_del;
 	ev_api->close = kqueue_close;
@@ -0,0 +1,290 @@
+/*
+ * Copyright (c) 2022-2024 Emil Engler <me@emilengler.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Required for clock_gettime(2). */
+#define _POSIX_C_SOURCE	200809L
+
+#include "config.h"
+
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "litev.h"
+#include "litev-internal.h"
+#include "latency.h"
+#include "mem.h"
+
+/*
+ * The histograms are log-linear: values below 2^LITEV_HIST_SUBBITS get a
+ * bucket of their own, while every further power of two is split into
+ * 2^LITEV_HIST_SUBBITS linear buckets.  This bounds the relative error of
+ * every bucket to 2^-LITEV_HIST_SUBBITS.  Values of 2^LITEV_HIST_MAXBIT
+ * nanoseconds and beyond end up in the last bucket.
+ */
+#define NSUB	(1 << LITEV_HIST_SUBBITS)
+
+static size_t			 hist_bucket(unsigned long long);
+static unsigned long long	 hist_upper(size_t);
+
+static struct latency_cb	*latency_find(struct latency *,
+				    void (*)(int, short, void *), int);
+static unsigned long long	 latency_now(void);
+
+static size_t
+hist_bucket(unsigned long long v)
+{
+	int	msb;
+
+	if (v < NSUB)
+		return (v);
+
+	for (msb = LITEV_HIST_SUBBITS; msb < 63 && v >> (msb + 1) != 0; ++msb)
+		;
+	if (msb > LITEV_HIST_MAXBIT)
+		return (LITEV_HIST_NBUCKETS - 1);
+
+	return ((size_t)(msb - LITEV_HIST_SUBBITS + 1) * NSUB +
+	    ((v >> (msb - LITEV_HIST_SUBBITS)) & (NSUB - 1)));
+}
+
+/*
+ * Return the largest value that is recorded inside bucket i.
+ */
+static unsigned long long
+hist_upper(size_t i)
+{
+	unsigned long long	sub;
+	int			msb;
+
+	if (i < NSUB)
+		return (i);
+
+	msb = i / NSUB - 1 + LITEV_HIST_SUBBITS;
+	sub = i % NSUB;
+
+	return (((NSUB + sub + 1) << (msb - LITEV_HIST_SUBBITS)) - 1);
+}
+
+/*
+ * Return the slot of cb or, if create is set, claim a free slot for it.
+ * NULL is returned, if there is no such slot.
+ */
+static struct latency_cb *
+latency_find(struct latency *lat, void (*cb)(int, short, void *), int create)
+{
+	size_t	i, n;
+
+	i = ((uintptr_t)cb >> 4) % LATENCY_NCB;
+	for (n = 0; n < LATENCY_NCB; ++n, i = (i + 1) % LATENCY_NCB) {
+		if (lat->cbs[i].cb == cb)
+			return (&lat->cbs[i]);
+		if (lat->cbs[i].cb == NULL)
+			break;
+	}
+	if (!create || n == LATENCY_NCB)
+		return (NULL);
+
+	lat->cbs[i].cb = cb;
+	return (&lat->cbs[i]);
+}
+
+static unsigned long long
+latency_now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+/*
+ * Execute the callback of ev and record its duration.  ev may be gone after
+ * the callback returned, for example due to litev_close(), so everything
+ * that is needed afterwards is copied beforehand.  The same applies to the
+ * instrumentation itself, which the callback may disable.
+ */
+void
+latency_cb(struct litev_base *base, struct litev_ev *ev)
+{
+	struct latency		 *lat;
+	struct latency_cb	 *slot;
+	void			(*cb)(int, short, void *);
+	unsigned long long	  start, d;
+	int			  fd;
+	short			  condition;
+
+	cb = ev->cb;
+	fd = ev->fd;
+	condition = ev->condition;
+
+	start = latency_now();
+	cb(fd, condition, ev->udata);
+	d = latency_now() - start;
+
+	if ((lat = base->latency) == NULL)
+		return;
+
+	/* The histogram of a callback is allocated on its first call. */
+	slot = latency_find(lat, cb, 1);
+	if (slot != NULL && slot->hist == NULL &&
+	    (slot->hist = mem_malloc(base, sizeof(struct litev_hist))) != NULL)
+		memset(slot->hist, 0, sizeof(struct litev_hist));
+	if (slot != NULL && slot->hist != NULL)
+		litev_hist_record(slot->hist, d);
+
+	if (lat->threshold != 0 && d >= lat->threshold)
+		lat->hook(fd, condition, d, lat->udata);
+}
+
+void
+latency_wait(struct litev_base *base)
+{
+	base->latency->wait_start = latency_now();
+}
+
+void
+latency_ready(struct litev_base *base)
+{
+	struct latency	*lat;
+
+	lat = base->latency;
+
+	/* The instrumentation has been enabled during the wait. */
+	if (lat->wait_start == 0)
+		return;
+
+	litev_hist_record(&lat->wait, latency_now() - lat->wait_start);
+	lat->wait_start = 0;
+}
+
+void
+latency_free(struct litev_base *base)
+{
+	size_t	i;
+
+	if (base->latency == NULL)
+		return;
+
+	for (i = 0; i < LATENCY_NCB; ++i)
+		mem_free(base, base->latency->cbs[i].hist);
+	mem_free(base, base->latency);
+	base->latency = NULL;
+}
+
+int
+litev_latency_enable(struct litev_base *base, unsigned long long threshold,
+    void (*hook)(int, short, unsigned long long, void *), void *udata)
+{
+	struct latency	*lat;
+
+	if (base == NULL || (threshold != 0 && hook == NULL))
+		return (LITEV_EINVAL);
+
+	if ((lat = base->latency) == NULL) {
+		if ((lat = mem_malloc(base, sizeof(struct latency))) == NULL)
+			return (-1);
+		memset(lat, 0, sizeof(struct latency));
+		base->latency = lat;
+	}
+
+	lat->threshold = threshold;
+	lat->hook = hook;
+	lat->udata = udata;
+
+	return (LITEV_OK);
+}
+
+void
+litev_latency_disable(struct litev_base *base)
+{
+	if (base != NULL)
+		latency_free(base);
+}
+
+int
+litev_latency_cb(struct litev_base *base, void (*cb)(int, short, void *),
+    struct litev_hist *hist)
+{
+	struct latency_cb	*slot;
+
+	if (base == NULL || cb == NULL || hist == NULL)
+		return (LITEV_EINVAL);
+	if (base->latency == NULL)
+		return (LITEV_EAGAIN);
+
+	slot = latency_find(base->latency, cb, 0);
+	if (slot == NULL || slot->hist == NULL)
+		return (LITEV_ENOENT);
+
+	memcpy(hist, slot->hist, sizeof(struct litev_hist));
+
+	return (LITEV_OK);
+}
+
+int
+litev_latency_wait(struct litev_base *base, struct litev_hist *hist)
+{
+	if (base == NULL || hist == NULL)
+		return (LITEV_EINVAL);
+	if (base->latency == NULL)
+		return (LITEV_EAGAIN);
+
+	memcpy(hist, &base->latency->wait, sizeof(struct litev_hist));
+
+	return (LITEV_OK);
+}
+
+void
+litev_hist_record(struct litev_hist *hist, unsigned long long v)
+{
+	++hist->count;
+	if (v > hist->max)
+		hist->max = v;
+	++hist->buckets[hist_bucket(v)];
+}
+
+unsigned long long
+litev_hist_quantile(const struct litev_hist *hist, double q)
+{
+	unsigned long long	rank, n;
+	size_t			i;
+
+	if (hist == NULL || hist->count == 0)
+		return (0);
+	if (q <= 0.0)
+		q = 0.0;
+	if (q >= 1.0)
+		return (hist->max);
+
+	/* The rank of the value that is at least as large as q of all. */
+	rank = (unsigned long long)(q * hist->count);
+	if (rank == 0 || (double)rank < q * hist->count)
+		++rank;
+	for (i = 0, n = 0; i < LITEV_HIST_NBUCKETS; ++i) {
+		if ((n += hist->buckets[i]) >= rank)
+			break;
+	}
+
+	/* The bucket might reach beyond the largest recorded value. */
+	if (i == LITEV_HIST_NBUCKETS || hist_upper(i) > hist->max)
+		return (hist->max);
+
+	return (hist_upper(i));
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2022-2024 Emil Engler <me@emilengler.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+/* Maximum amount of distinct callback functions that are tracked. */
+#define LATENCY_NCB	64
+
+struct latency_cb {
+	void			(*cb)(int, short, void *);
+	struct litev_hist	 *hist;
+};
+
+/*
+ * The histograms of the callbacks live in an open addressing hash table,
+ * keyed by the address of the callback function.
+ */
+struct latency {
+	struct latency_cb	  cbs[LATENCY_NCB];
+	struct litev_hist	  wait;
+	unsigned long long	  wait_start;
+	unsigned long long	  threshold;
+	void			(*hook)(int, short, unsigned long long,
+				    void *);
+	void			 *udata;
+};
+
+void	latency_free(struct litev_base *);
+
+#endif
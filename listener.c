@@ -0,0 +1,413 @@
+/*
+ * Copyright (c) 2022-2024 Emil Engler <me@emilengler.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Required for accept4(2) and sched_setaffinity(2). */
+#define _GNU_SOURCE
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#ifdef USE_REUSEPORT_CBPF
+#include <linux/filter.h>
+#include <sched.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "litev.h"
+#include "litev-internal.h"
+#include "listener.h"
+#include "mem.h"
+
+static int			 listener_accept(int);
+static void			 listener_cb(int, short, void *);
+static struct litev_listener	**listener_find(struct litev_base *, int);
+static int			 listener_pause(struct litev_listener *);
+static void			 listener_unlink(struct litev_listener **);
+
+/*
+ * Accept a connection and make it non-blocking and close-on-exec.
+ */
+static int
+listener_accept(int s)
+{
+#ifdef USE_ACCEPT4
+	return (accept4(s, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC));
+#else
+	int	c, flags;
+
+	if ((c = accept(s, NULL, NULL)) == -1)
+		return (-1);
+
+	if ((flags = fcntl(c, F_GETFL)) == -1 ||
+	    fcntl(c, F_SETFL, flags | O_NONBLOCK) == -1 ||
+	    fcntl(c, F_SETFD, FD_CLOEXEC) == -1) {
+		close(c);
+		return (-1);
+	}
+
+	return (c);
+#endif
+}
+
+/*
+ * Accept connections until the backlog is empty or the budget is exhausted.
+ * Connections that are left in the backlog keep the listening socket
+ * readable, so they will be accepted during the next iteration.
+ */
+static void
+listener_cb(int s, short condition, void *udata)
+{
+	struct litev_listener	*l;
+	struct litev_ev		 ev;
+	size_t			 n;
+	int			 c, error;
+
+	l = udata;
+	l->is_running = 1;
+
+	for (n = 0; l->opts.budget == 0 || n < l->opts.budget; ++n) {
+		if ((c = listener_accept(s)) == -1) {
+			/* The peer gave up before we got to it. */
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+
+			/*
+			 * The pending connection stays in the backlog and
+			 * keeps the socket readable, so stop listening
+			 * instead of spinning until FDs become available.
+			 */
+			if (errno == EMFILE || errno == ENFILE ||
+			    errno == ENOBUFS || errno == ENOMEM) {
+				error = errno;
+				if (listener_pause(l) != LITEV_OK ||
+				    l->opts.err_cb == NULL)
+					break;
+				l->opts.err_cb(s, error, l->opts.udata);
+			}
+			break;
+		}
+
+		if (l->opts.cb != NULL) {
+			ev.fd = c;
+			ev.condition = LITEV_READ;
+			ev.cb = l->opts.cb;
+			ev.udata = l->opts.udata;
+			if (litev_add(l->base, &ev) != LITEV_OK) {
+				close(c);
+				continue;
+			}
+		}
+
+		if (l->cb != NULL)
+			l->cb(c, l->opts.udata);
+		if (l->is_dead)
+			break;
+	}
+
+	if (l->is_dead)
+		mem_free(l->base, l);
+	else
+		l->is_running = 0;
+}
+
+/*
+ * Return a pointer to the link that points to the listener of fd or a pointer
+ * to the terminating NULL link, if there is none.
+ */
+static struct litev_listener **
+listener_find(struct litev_base *base, int fd)
+{
+	struct litev_listener	**lp;
+
+	for (lp = &base->listeners; *lp != NULL; lp = &(*lp)->next) {
+		if ((*lp)->fd == fd)
+			break;
+	}
+
+	return (lp);
+}
+
+/*
+ * Remove the event of a listener, until litev_listener_resume() adds it
+ * again.
+ */
+static int
+listener_pause(struct litev_listener *l)
+{
+	struct litev_ev	ev;
+	int		rc;
+
+	ev.fd = l->fd;
+	ev.condition = LITEV_READ;
+	if ((rc = litev_del(l->base, &ev)) != LITEV_OK)
+		return (rc);
+	l->is_paused = 1;
+
+	return (LITEV_OK);
+}
+
+static void
+listener_unlink(struct litev_listener **lp)
+{
+	struct litev_listener	*l;
+
+	l = *lp;
+	*lp = l->next;
+
+	if (l->is_running)
+		l->is_dead = 1;
+	else
+		mem_free(l->base, l);
+}
+
+void
+listener_free(struct litev_base *base)
+{
+	struct litev_listener	*tmp;
+
+	while (base->listeners != NULL) {
+		tmp = base->listeners;
+		base->listeners = tmp->next;
+		mem_free(base, tmp);
+	}
+}
+
+/*
+ * Forget the listener of fd, if any, without touching the event loop.
+ */
+void
+listener_close(struct litev_base *base, int fd)
+{
+	struct litev_listener	**lp;
+
+	if (*(lp = listener_find(base, fd)) != NULL)
+		listener_unlink(lp);
+}
+
+int
+litev_listener_add(struct litev_base *base, int fd, void (*cb)(int, void *),
+    const struct litev_listener_opts *opts)
+{
+	struct litev_listener	*l;
+	struct litev_ev		 ev;
+	int			 rc;
+
+	if (base == NULL || fd < 0)
+		return (LITEV_EINVAL);
+	if (cb == NULL && (opts == NULL || opts->cb == NULL))
+		return (LITEV_EINVAL);
+
+	if (*listener_find(base, fd) != NULL)
+		return (LITEV_EEXIST);
+
+	if ((l = mem_malloc(base, sizeof(struct litev_listener))) == NULL)
+		return (-1);
+
+	if (opts != NULL)
+		memcpy(&l->opts, opts, sizeof(struct litev_listener_opts));
+	else
+		memset(&l->opts, 0, sizeof(struct litev_listener_opts));
+	l->base = base;
+	l->cb = cb;
+	l->fd = fd;
+	l->is_paused = 0;
+	l->is_running = 0;
+	l->is_dead = 0;
+
+	ev.fd = fd;
+	ev.condition = LITEV_READ;
+	ev.cb = listener_cb;
+	ev.udata = l;
+	if ((rc = litev_add(base, &ev)) != LITEV_OK) {
+		mem_free(base, l);
+		return (rc);
+	}
+
+	l->next = base->listeners;
+	base->listeners = l;
+
+	return (LITEV_OK);
+}
+
+int
+litev_listener_del(struct litev_base *base, int fd)
+{
+	struct litev_listener	**lp;
+	struct litev_ev		 ev;
+	int			 rc;
+
+	if (base == NULL || fd < 0)
+		return (LITEV_EINVAL);
+
+	if (*(lp = listener_find(base, fd)) == NULL)
+		return (LITEV_ENOENT);
+
+	if (!(*lp)->is_paused) {
+		ev.fd = fd;
+		ev.condition = LITEV_READ;
+		if ((rc = litev_del(base, &ev)) != LITEV_OK)
+			return (rc);
+	}
+
+	listener_unlink(lp);
+
+	return (LITEV_OK);
+}
+
+/*
+ * Continue accepting connections on a listener that has stopped, because
+ * the process or the system ran out of FDs or memory.
+ */
+int
+litev_listener_resume(struct litev_base *base, int fd)
+{
+	struct litev_listener	*l;
+	struct litev_ev		 ev;
+	int			 rc;
+
+	if (base == NULL || fd < 0)
+		return (LITEV_EINVAL);
+
+	if ((l = *listener_find(base, fd)) == NULL)
+		return (LITEV_ENOENT);
+	if (!l->is_paused)
+		return (LITEV_OK);
+
+	ev.fd = fd;
+	ev.condition = LITEV_READ;
+	ev.cb = listener_cb;
+	ev.udata = l;
+	if ((rc = litev_add(base, &ev)) != LITEV_OK)
+		return (rc);
+	l->is_paused = 0;
+
+	return (LITEV_OK);
+}
+
+#ifdef USE_REUSEPORT_CBPF
+
+/*
+ * Create n listening sockets on addr, which share the port through
+ * SO_REUSEPORT, and store them in fds.  A classic BPF program steers every
+ * connection to the socket whose index is the CPU that received it, modulo
+ * n, so that a base on CPU i serving fds[i] handles the packets, the accept
+ * and the callbacks of its connections on a single core.  If the port of
+ * addr is zero, all sockets share the port chosen for the first one.
+ */
+int
+litev_listener_group(const struct sockaddr *addr, size_t addrlen,
+    int backlog, int *fds, size_t n)
+{
+	struct sockaddr_storage	 ss;
+	struct sock_filter	 code[] = {
+		/* A = the CPU that processes the packet */
+		{ BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+		/* A = A % n */
+		{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, 0 },
+		/* Return A as the index of the socket. */
+		{ BPF_RET | BPF_A, 0, 0, 0 }
+	};
+	struct sock_fprog	 prog;
+	socklen_t		 sslen;
+	size_t			 i;
+	int			 one, saved_errno;
+
+	if (addr == NULL || addrlen > sizeof(ss) || fds == NULL || n == 0 ||
+	    n > UINT32_MAX)
+		return (LITEV_EINVAL);
+
+	memcpy(&ss, addr, addrlen);
+	sslen = addrlen;
+	one = 1;
+	for (i = 0; i < n; ++i) {
+		fds[i] = socket(ss.ss_family,
+		    SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (fds[i] == -1)
+			goto err;
+
+		/* The index of a socket is the order in which it listens. */
+		if (setsockopt(fds[i], SOL_SOCKET, SO_REUSEPORT, &one,
+		    sizeof(one)) == -1 ||
+		    bind(fds[i], (struct sockaddr *)&ss, sslen) == -1 ||
+		    listen(fds[i], backlog) == -1) {
+			close(fds[i]);
+			goto err;
+		}
+
+		if (i == 0 && getsockname(fds[0], (struct sockaddr *)&ss,
+		    &sslen) == -1) {
+			close(fds[0]);
+			goto err;
+		}
+	}
+
+	code[1].k = n;
+	prog.len = sizeof(code) / sizeof(code[0]);
+	prog.filter = code;
+	if (setsockopt(fds[0], SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog,
+	    sizeof(prog)) == -1)
+		goto err;
+
+	return (LITEV_OK);
+err:
+	saved_errno = errno;
+	while (i-- > 0)
+		close(fds[i]);
+	errno = saved_errno;
+	return (-1);
+}
+
+/*
+ * Pin the calling thread to cpu, which is meant to be done by the thread of
+ * every base serving a socket of litev_listener_group().
+ */
+int
+litev_pin_cpu(int cpu)
+{
+	cpu_set_t	set;
+
+	if (cpu < 0 || cpu >= CPU_SETSIZE)
+		return (LITEV_EINVAL);
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	return (sched_setaffinity(0, sizeof(set), &set) == 0 ? LITEV_OK : -1);
+}
+
+#else
+
+int
+litev_listener_group(const struct sockaddr *addr, size_t addrlen,
+    int backlog, int *fds, size_t n)
+{
+	return (LITEV_ENOTSUP);
+}
+
+int
+litev_pin_cpu(int cpu)
+{
+	return (LITEV_ENOTSUP);
+}
+
+#endif
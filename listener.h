@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2022-2024 Emil Engler <me@emilengler.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LISTENER_H
+#define LISTENER_H
+
+/*
+ * The listeners of a base are kept in a singly linked list, as a base
+ * usually only has a handful of them.
+ */
+struct litev_listener {
+	struct litev_listener	 *next;
+	struct litev_base	 *base;
+	struct litev_listener_opts opts;
+	void			(*cb)(int, void *);
+	int			  fd;
+
+	/* Set while accept(2) fails for a lack of FDs or memory. */
+	int			  is_paused;
+
+	/*
+	 * A listener that gets removed from within one of its own callbacks
+	 * is only unlinked and freed once listener_cb() returns.
+	 */
+	int			  is_running;
+	int			  is_dead;
+};
+
+void	listener_free(struct litev_base *);
+void	listener_close(struct litev_base *, int);
+
+#endif
@@ -0,0 +1,493 @@
+/*
+ * Copyright (c) 2022-2024 Emil Engler <me@emilengler.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * C++20 coroutines on top of litev.hpp.
+ *
+ *	litev::co::Task
+ *	echo(litev::co::Loop &loop, int fd)
+ *	{
+ *		auto	rd = litev::co::readable(loop, fd);
+ *		auto	wr = litev::co::writable(loop, fd);
+ *		char	buf[512];
+ *		ssize_t	n;
+ *
+ *		while (co_await rd == LITEV_OK &&
+ *		    (n = read(fd, buf, sizeof(buf))) > 0) {
+ *			co_await wr;
+ *			write(fd, buf, n);
+ *		}
+ *	}
+ *
+ *	echo(loop, fd).detach();
+ *
+ * A Task starts running immediately and is resumed straight from the
+ * callback of the event it waits for.  If the first parameter of a
+ * coroutine is a co::Loop, its frame comes from the pool of that loop,
+ * which must therefore outlive the coroutine.  Destroying a Task that
+ * waits for an event removes the event.
+ */
+
+#ifndef LITEV_CORO_HPP
+#define LITEV_CORO_HPP
+
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <new>
+#include <utility>
+
+#include "litev.hpp"
+
+namespace litev::co {
+
+/*
+ * Recycles coroutine frames through one free list per power of two size
+ * class.  Every frame is preceded by a header that leads back to its pool;
+ * frames that are too large, or not associated with a pool, come straight
+ * from operator new.
+ */
+class Pool {
+public:
+	Pool() = default;
+	Pool(const Pool &) = delete;
+	Pool &operator=(const Pool &) = delete;
+
+	~Pool()
+	{
+		Node	*n;
+
+		for (std::size_t i = 0; i < NCLASS; ++i) {
+			while ((n = free_[i]) != nullptr) {
+				free_[i] = n->next;
+				::operator delete(n);
+			}
+		}
+	}
+
+	static void *
+	alloc(Pool *pool, std::size_t size)
+	{
+		Header		*hdr;
+		std::size_t	 cls;
+
+		size += sizeof(Header);
+		for (cls = 0; cls < NCLASS && size > MINSIZE << cls; ++cls)
+			;
+		if (pool == nullptr || cls == NCLASS) {
+			hdr = static_cast<Header *>(::operator new(size));
+			hdr->pool = nullptr;
+		} else if (pool->free_[cls] != nullptr) {
+			hdr = reinterpret_cast<Header *>(pool->free_[cls]);
+			pool->free_[cls] = pool->free_[cls]->next;
+			hdr->pool = pool;
+		} else {
+			hdr = static_cast<Header *>(
+			    ::operator new(MINSIZE << cls));
+			hdr->pool = pool;
+		}
+		hdr->cls = cls;
+
+		return (hdr + 1);
+	}
+
+	static void
+	free(void *ptr)
+	{
+		Header	*hdr;
+		Node	*n;
+		Pool	*pool;
+
+		hdr = static_cast<Header *>(ptr) - 1;
+		if ((pool = hdr->pool) == nullptr) {
+			::operator delete(hdr);
+			return;
+		}
+
+		n = reinterpret_cast<Node *>(hdr);
+		n->next = pool->free_[hdr->cls];
+		pool->free_[hdr->cls] = n;
+	}
+
+private:
+	static constexpr std::size_t	MINSIZE = 64;
+	static constexpr std::size_t	NCLASS = 8;
+
+	struct alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) Header {
+		Pool		*pool;
+		std::size_t	 cls;
+	};
+
+	struct Node {
+		Node	*next;
+	};
+
+	Node	*free_[NCLASS] = {};
+};
+
+/*
+ * A litev::Loop with a pool for coroutine frames.
+ */
+class Loop : public litev::Loop {
+public:
+	using litev::Loop::Loop;
+
+	Pool &
+	pool()
+	{
+		return (pool_);
+	}
+
+private:
+	Pool	pool_;
+};
+
+class Task {
+public:
+	struct promise_type;
+
+	struct FinalAwaiter {
+		bool
+		await_ready() const noexcept
+		{
+			return (false);
+		}
+
+		std::coroutine_handle<>
+		await_suspend(std::coroutine_handle<promise_type> h) noexcept
+		{
+			promise_type	&p = h.promise();
+
+			if (p.continuation)
+				return (p.continuation);
+			if (p.is_detached) {
+				/* Nobody could ever observe the exception. */
+				if (p.exception)
+					std::terminate();
+				h.destroy();
+			}
+			return (std::noop_coroutine());
+		}
+
+		void
+		await_resume() const noexcept
+		{
+		}
+	};
+
+	struct promise_type {
+		std::coroutine_handle<>	continuation;
+		std::exception_ptr	exception;
+		bool			is_detached = false;
+
+		Task
+		get_return_object()
+		{
+			return (Task(std::coroutine_handle<
+			    promise_type>::from_promise(*this)));
+		}
+
+		std::suspend_never
+		initial_suspend() const noexcept
+		{
+			return {};
+		}
+
+		FinalAwaiter
+		final_suspend() const noexcept
+		{
+			return {};
+		}
+
+		void
+		return_void() const noexcept
+		{
+		}
+
+		void
+		unhandled_exception()
+		{
+			exception = std::current_exception();
+		}
+
+		static void *
+		operator new(std::size_t size)
+		{
+			return (Pool::alloc(nullptr, size));
+		}
+
+		/*
+		 * Inlined, as g++ takes a template for a mismatch with
+		 * operator delete otherwise.
+		 */
+		template <typename... Args>
+		[[gnu::always_inline]] static void *
+		operator new(std::size_t size, Loop &loop, Args &...)
+		{
+			return (Pool::alloc(&loop.pool(), size));
+		}
+
+		/* The header of the frame leads back to its pool. */
+		static void
+		operator delete(void *ptr, std::size_t)
+		{
+			Pool::free(ptr);
+		}
+	};
+
+	Task(const Task &) = delete;
+	Task &operator=(const Task &) = delete;
+
+	Task(Task &&o) noexcept : h_(std::exchange(o.h_, nullptr))
+	{
+	}
+
+	Task &
+	operator=(Task &&o) noexcept
+	{
+		if (this != &o) {
+			if (h_)
+				h_.destroy();
+			h_ = std::exchange(o.h_, nullptr);
+		}
+		return (*this);
+	}
+
+	~Task()
+	{
+		if (h_)
+			h_.destroy();
+	}
+
+	bool
+	done() const
+	{
+		return (!h_ || h_.done());
+	}
+
+	/*
+	 * Let the coroutine free itself once it has finished.
+	 */
+	void
+	detach()
+	{
+		if (!h_)
+			return;
+		if (h_.done())
+			h_.destroy();
+		else
+			h_.promise().is_detached = true;
+		h_ = nullptr;
+	}
+
+	bool
+	await_ready() const noexcept
+	{
+		return (done());
+	}
+
+	void
+	await_suspend(std::coroutine_handle<> cont) noexcept
+	{
+		h_.promise().continuation = cont;
+	}
+
+	void
+	await_resume() const
+	{
+		if (h_ && h_.promise().exception)
+			std::rethrow_exception(h_.promise().exception);
+	}
+
+private:
+	explicit Task(std::coroutine_handle<promise_type> h) : h_(h)
+	{
+	}
+
+	std::coroutine_handle<promise_type>	h_;
+};
+
+/*
+ * Waits for condition on fd, every time it is awaited.  The event stays
+ * registered in between and is only disabled, once it fires while nobody
+ * waits, so that awaiting it again in a loop is usually free.  co_await
+ * yields LITEV_OK, or the error of registering the event without
+ * suspending.
+ */
+class IoAwaiter {
+public:
+	IoAwaiter(litev::Loop &loop, int fd, short condition)
+	    : base_(loop.get()), handle_(), fd_(fd), condition_(condition)
+	{
+	}
+
+	IoAwaiter(const IoAwaiter &) = delete;
+	IoAwaiter &operator=(const IoAwaiter &) = delete;
+
+	/* The handle is already stale if the FD went through litev_close(). */
+	~IoAwaiter()
+	{
+		if (is_registered_)
+			litev_del_handle(base_, &handle_);
+	}
+
+	bool
+	await_ready() const noexcept
+	{
+		return (false);
+	}
+
+	bool
+	await_suspend(std::coroutine_handle<> h) noexcept
+	{
+		struct litev_ev	ev;
+
+		if (is_registered_ && !is_enabled_) {
+			rc_ = litev_enable(base_, &handle_);
+			if (rc_ == LITEV_ENOENT)
+				is_registered_ = false;
+			else if (rc_ != LITEV_OK)
+				return (false);
+			is_enabled_ = rc_ == LITEV_OK;
+		}
+		if (!is_registered_) {
+			ev.fd = fd_;
+			ev.condition = condition_;
+			ev.cb = cb;
+			ev.udata = this;
+			if ((rc_ = litev_add_handle(base_, &ev, &handle_)) !=
+			    LITEV_OK)
+				return (false);
+			is_registered_ = is_enabled_ = true;
+		}
+		h_ = h;
+
+		return (true);
+	}
+
+	int
+	await_resume() const noexcept
+	{
+		return (rc_);
+	}
+
+protected:
+	static void
+	cb(int, short, void *udata)
+	{
+		IoAwaiter	*a;
+
+		/* The coroutine might destroy the awaiter once resumed. */
+		a = static_cast<IoAwaiter *>(udata);
+		if (a->h_) {
+			std::exchange(a->h_, nullptr).resume();
+			return;
+		}
+
+		/* Nobody waits, so stop the event from firing again. */
+		if (litev_disable(a->base_, &a->handle_) == LITEV_OK)
+			a->is_enabled_ = false;
+	}
+
+	struct litev_base	*base_;
+	struct litev_handle	 handle_;
+	std::coroutine_handle<>	 h_;
+	int			 fd_;
+	int			 rc_ = LITEV_OK;
+	short			 condition_;
+	bool			 is_enabled_ = false;
+	bool			 is_registered_ = false;
+};
+
+inline IoAwaiter
+readable(litev::Loop &loop, int fd)
+{
+	return (IoAwaiter(loop, fd, LITEV_READ));
+}
+
+inline IoAwaiter
+writable(litev::Loop &loop, int fd)
+{
+	return (IoAwaiter(loop, fd, LITEV_WRITE));
+}
+
+/*
+ * Suspends for a duration, using a timer of the loop.  co_await yields
+ * LITEV_OK, or the error of litev_timer_add() without suspending.
+ */
+class SleepAwaiter {
+public:
+	SleepAwaiter(litev::Loop &loop, std::chrono::nanoseconds d)
+	    : base_(loop.get()), d_(d)
+	{
+		litev_timer_init(&timer_, cb, this);
+	}
+
+	SleepAwaiter(const SleepAwaiter &) = delete;
+	SleepAwaiter &operator=(const SleepAwaiter &) = delete;
+
+	~SleepAwaiter()
+	{
+		if (litev_timer_pending(&timer_))
+			litev_timer_del(base_, &timer_);
+	}
+
+	bool
+	await_ready() const noexcept
+	{
+		return (d_.count() <= 0);
+	}
+
+	bool
+	await_suspend(std::coroutine_handle<> h) noexcept
+	{
+		h_ = h;
+		rc_ = litev_timer_add(base_, &timer_,
+		    std::chrono::ceil<std::chrono::microseconds>(d_).count());
+
+		return (rc_ == LITEV_OK);
+	}
+
+	int
+	await_resume() const noexcept
+	{
+		return (rc_);
+	}
+
+private:
+	static void
+	cb(void *udata)
+	{
+		static_cast<SleepAwaiter *>(udata)->h_.resume();
+	}
+
+	struct litev_base		*base_;
+	struct litev_timer		 timer_;
+	std::coroutine_handle<>		 h_;
+	std::chrono::nanoseconds	 d_;
+	int				 rc_ = LITEV_OK;
+};
+
+inline SleepAwaiter
+sleep_for(litev::Loop &loop, std::chrono::nanoseconds d)
+{
+	return (SleepAwaiter(loop, d));
+}
+
+}
+
+#endif
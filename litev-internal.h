@@ -20,24 +20,186 @@
 /* Opaque pointer that holds the data for a kernel event notification API. */
 typedef void EV_API_DATA;
 
+struct litev_base;
+struct timespec;
+
 /* Structure to define the backend of a kernel event notification API. */
 struct litev_ev_api {
-	EV_API_DATA	*(*init)(void);
+	const char	 *name;
+
+	EV_API_DATA	*(*init)(struct litev_base *);
 	void		 (*free)(EV_API_DATA *);
 
-	int		 (*poll)(EV_API_DATA *);
+	/* poll() waits for at most timeout, or forever if it is NULL. */
+	int		 (*poll)(EV_API_DATA *, const struct timespec *);
+
+	/*
+	 * reinit() replaces the kernel object after fork(2) and registers all
+	 * enabled nodes with it again.
+	 */
+	int		 (*reinit)(EV_API_DATA *);
 
+	/* fd() returns the FD of the kernel object, or -1 if there is none. */
+	int		 (*fd)(EV_API_DATA *);
+
+	/*
+	 * add() and del() enable and disable a node inside the kernel.
+	 * close() is called before the nodes of the FD are removed from the
+	 * hash table and must close the FD.
+	 */
 	int		 (*add)(EV_API_DATA *, struct litev_ev *);
 	int		 (*del)(EV_API_DATA *, struct litev_ev *);
 	int		 (*close)(EV_API_DATA *, int);
 };
 
+/* Amount of size classes of an arena, see mem.c. */
+#define ARENA_NCLASS	48
+
+/* A region of memory from which the allocations of a base are carved. */
+struct litev_arena {
+	unsigned char	*start;
+	unsigned char	*end;
+	unsigned char	*next;
+	void		*freelist[ARENA_NCLASS];
+	int		 flags;
+};
+
+struct handle_slot;
+struct litev_child;
+struct latency;
+struct litev_listener;
+struct litev_rl;
+struct trace;
+
 struct litev_base {
 	EV_API_DATA		*ev_api_data;
 	struct litev_ev_api	 ev_api;
 
+	struct litev_ev		**hash;
+	struct handle_slot	 *handles;
+	size_t			  nhandle;
+	unsigned int		  free_handle;
+
+	struct litev_allocator	 allocator;
+	struct litev_arena	 arena;
+
+	struct litev_listener	*listeners;
+	struct litev_rl		*rls;
+
+	/* See child.c for the SIGCHLD fallback. */
+	struct litev_child	*children;
+	int			 sigchld[2];
+	size_t			 sigchld_slot;
+
+	struct litev_timer	**timers;
+	size_t			  ntimer;
+	size_t			  maxtimer;
+	unsigned long long	  slack;	/* Nanoseconds. */
+
+	struct litev_stats	 stats;
+	struct latency		*latency;
+	struct trace		*trace;
+
 	int			 is_dispatched;
 	int			 is_quitting;
 };
 
+/* See litev.c. */
+int			ev_add(struct litev_base *, struct litev_ev *, int,
+			    struct litev_ev **);
+int			ev_del(struct litev_base *, struct litev_ev *);
+int			ev_timeout_ms(const struct timespec *);
+
+/* See latency.c. */
+void			latency_cb(struct litev_base *, struct litev_ev *);
+void			latency_wait(struct litev_base *);
+void			latency_ready(struct litev_base *);
+
+/* See trace.c. */
+#ifdef LITEV_TRACE
+void			trace_rec(struct litev_base *, int, int, short);
+#define TRACE(base, type, arg, condition)	\
+	trace_rec((base), (type), (arg), (condition))
+#else
+#define TRACE(base, type, arg, condition)
+#endif
+
+static inline void	ev_cb(struct litev_base *, struct litev_ev *);
+static inline void	ev_wait(struct litev_base *);
+static inline void	ev_ready(struct litev_base *, int);
+
+/*
+ * Execute the callback of an event on behalf of the backend.
+ */
+static inline void
+ev_cb(struct litev_base *base, struct litev_ev *ev)
+{
+#ifdef LITEV_TRACE
+	int	fd;
+	short	condition;
+
+	/* The callback may remove ev, see latency_cb(). */
+	fd = ev->fd;
+	condition = ev->condition;
+#endif
+
+	TRACE(base, LITEV_TRACE_CB_BEGIN, fd, condition);
+
+	switch (ev->condition) {
+	case LITEV_READ:
+		++base->stats.ncb_read;
+		break;
+	case LITEV_WRITE:
+		++base->stats.ncb_write;
+		break;
+	case LITEV_ERRQUEUE:
+		++base->stats.ncb_errqueue;
+		break;
+	}
+
+	if (base->latency != NULL)
+		latency_cb(base, ev);
+	else
+		ev->cb(ev->fd, ev->condition, ev->udata);
+
+	TRACE(base, LITEV_TRACE_CB_END, fd, condition);
+}
+
+/*
+ * Mark the beginning of a wait of the backend.
+ */
+static inline void
+ev_wait(struct litev_base *base)
+{
+	TRACE(base, LITEV_TRACE_WAIT, 0, 0);
+
+	if (base->latency != NULL)
+		latency_wait(base);
+}
+
+/*
+ * Account for a wait of the backend that returned nready events, which is
+ * -1 if the wait has been interrupted.
+ */
+static inline void
+ev_ready(struct litev_base *base, int nready)
+{
+	int	i;
+
+	TRACE(base, LITEV_TRACE_READY, nready, 0);
+
+	if (base->latency != NULL)
+		latency_ready(base);
+
+	if (nready <= 0) {
+		++base->stats.nwakeups_empty;
+		++base->stats.nready[0];
+		return;
+	}
+
+	for (i = 1; i < LITEV_STATS_NREADY - 1 && nready >> i != 0; ++i)
+		;
+	++base->stats.nready[i];
+}
+
 #endif
@@ -14,58 +14,279 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+/* Required for struct timespec. */
+#define _POSIX_C_SOURCE	200809L
+
 #include "config.h"
 
 #include <sys/types.h>
 
+#include <limits.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "litev.h"
 #include "litev-internal.h"
+#include "child.h"
 #include "ev_api.h"
+#include "handle.h"
+#include "hash.h"
+#include "latency.h"
+#include "listener.h"
+#include "mem.h"
+#include "ratelimit.h"
+#include "timer.h"
+#include "trace.h"
+
+struct backend {
+	const char	 *name;
+	void		(*ev_api)(struct litev_ev_api *);
+};
+
+static const struct backend	*backend_find(const char *);
+
+/* All backends that are available, the first one being the default. */
+static const struct backend	backends[] = {
+#ifdef USE_KQUEUE
+	{ "kqueue",	ev_api_kqueue },
+#endif
+#ifdef USE_EPOLL
+	{ "epoll",	ev_api_epoll },
+#endif
+#ifdef USE_POLL
+	{ "poll",	ev_api_poll },
+#endif
+	/* Only for tests and benchmarks, see null.c. */
+	{ "null",	ev_api_null }
+};
+
+/*
+ * Return the backend called name, the one from the LITEV_BACKEND environment
+ * variable if name is NULL, or the default one if neither is set.
+ */
+static const struct backend *
+backend_find(const char *name)
+{
+	size_t	i;
+
+	if (name == NULL && (name = getenv("LITEV_BACKEND")) != NULL &&
+	    *name == '\0')
+		name = NULL;
+	if (name == NULL)
+		return (&backends[0]);
+
+	for (i = 0; i < sizeof(backends) / sizeof(backends[0]); ++i) {
+		if (strcmp(backends[i].name, name) == 0)
+			return (&backends[i]);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Register ev, which becomes the node itself if is_intrusive is set, and
+ * return its node through node_ptr, if it is not NULL.
+ */
+int
+ev_add(struct litev_base *base, struct litev_ev *ev, int is_intrusive,
+    struct litev_ev **node_ptr)
+{
+	struct litev_ev	*node;
+	int		 rc;
+
+	if (hash_lookup(base->hash, ev) != NULL)
+		return (LITEV_EEXIST);
+
+	if ((node = hash_add(base, base->hash, ev, is_intrusive)) == NULL)
+		return (-1);
+	if ((rc = base->ev_api.add(base->ev_api_data, node)) != LITEV_OK) {
+		hash_del(base, base->hash, node);
+		return (rc);
+	}
+	node->link.is_enabled = 1;
+
+	if (node_ptr != NULL)
+		*node_ptr = node;
+
+	return (LITEV_OK);
+}
+
+/*
+ * Unregister the event of node, which is gone afterwards.
+ */
+int
+ev_del(struct litev_base *base, struct litev_ev *node)
+{
+	int	rc;
+
+	if (node->link.is_enabled &&
+	    (rc = base->ev_api.del(base->ev_api_data, node)) != LITEV_OK)
+		return (rc);
+	hash_del(base, base->hash, node);
+
+	return (LITEV_OK);
+}
 
 struct litev_base *
 litev_init(void)
 {
-	struct litev_base	*base;
+	return (litev_init_ex(NULL));
+}
 
-	if ((base = malloc(sizeof(struct litev_base))) == NULL)
-		return (NULL);
+struct litev_base *
+litev_init_backend(const char *backend)
+{
+	struct litev_opts	opts;
 
-#if defined(USE_KQUEUE)
-	ev_api_kqueue(&base->ev_api);
-#elif defined(USE_EPOLL)
-	ev_api_epoll(&base->ev_api);
-#elif defined(USE_POLL)
-	ev_api_poll(&base->ev_api);
-#endif
+	memset(&opts, 0, sizeof(struct litev_opts));
+	opts.backend = backend;
 
-	if ((base->ev_api_data = base->ev_api.init()) == NULL) {
-		free(base);
+	return (litev_init_ex(&opts));
+}
+
+struct litev_base *
+litev_init_ex(const struct litev_opts *opts)
+{
+	const struct litev_allocator	*allocator;
+	const struct backend		*backend;
+	struct litev_base		*base;
+
+	/* An unknown backend is an error rather than a silent fallback. */
+	backend = backend_find(opts != NULL ? opts->backend : NULL);
+	if (backend == NULL)
 		return (NULL);
-	}
 
+	/* The base itself always comes from the allocator. */
+	allocator = opts != NULL ? opts->allocator : NULL;
+	if (allocator != NULL &&
+	    (allocator->malloc == NULL || allocator->realloc == NULL ||
+	    allocator->free == NULL))
+		return (NULL);
+	if (allocator != NULL)
+		base = allocator->malloc(allocator->ctx,
+		    sizeof(struct litev_base));
+	else
+		base = malloc(sizeof(struct litev_base));
+	if (base == NULL)
+		return (NULL);
+
+	if (mem_init(base, opts) != LITEV_OK)
+		goto err;
+	memset(&base->stats, 0, sizeof(struct litev_stats));
+	base->latency = NULL;
+	base->handles = NULL;
+	base->nhandle = 0;
+	base->free_handle = 0;
+	if ((base->hash = hash_init(base)) == NULL)
+		goto err_mem;
+	if (trace_init(base) != LITEV_OK)
+		goto err_hash;
+
+	backend->ev_api(&base->ev_api);
+
+	if ((base->ev_api_data = base->ev_api.init(base)) == NULL)
+		goto err_trace;
+
+	base->listeners = NULL;
+	base->rls = NULL;
+	base->children = NULL;
+	base->sigchld[0] = -1;
+	base->sigchld[1] = -1;
+	base->sigchld_slot = 0;
+	base->timers = NULL;
+	base->ntimer = 0;
+	base->maxtimer = 0;
+	base->slack = 0;
 	base->is_dispatched = 0;
 	base->is_quitting = 0;
 
 	return (base);
+err_trace:
+	trace_free(base);
+err_hash:
+	hash_free(base, &base->hash);
+err_mem:
+	mem_fini(base);
+err:
+	if (allocator != NULL)
+		allocator->free(allocator->ctx, base);
+	else
+		free(base);
+	return (NULL);
 }
 
 void
-litev_free(struct litev_base **base)
+litev_free(struct litev_base **base_ptr)
 {
-	if (base == NULL || *base == NULL)
+	struct litev_base	*base;
+	struct litev_allocator	 allocator;
+
+	if (base_ptr == NULL || *base_ptr == NULL)
 		return;
+	base = *base_ptr;
+
+	base->ev_api.free(base->ev_api_data);
+	hash_free(base, &base->hash);
+	handle_free(base);
+	listener_free(base);
+	rl_free(base);
+	child_free(base);
+	timer_free(base);
+	latency_free(base);
+	trace_free(base);
+	mem_fini(base);
+
+	allocator = base->allocator;
+	allocator.free(allocator.ctx, base);
+	*base_ptr = NULL;
+}
 
-	(*base)->ev_api.free((*base)->ev_api_data);
-	free(*base);
-	*base = NULL;
+/*
+ * Give the base its own kernel object in the child after fork(2), with all
+ * enabled events registered again, so that the registrations of parent and
+ * child do not affect each other.  The base should not be used if this
+ * fails.
+ */
+int
+litev_reinit_after_fork(struct litev_base *base)
+{
+	if (base == NULL)
+		return (LITEV_EINVAL);
+
+	return (base->ev_api.reinit(base->ev_api_data));
 }
 
+/*
+ * Convert timeout to the milliseconds of epoll(2) and poll(2), rounded up
+ * in order to not wake up early, and -1 if it is NULL.
+ */
 int
-litev_dispatch(struct litev_base *base)
+ev_timeout_ms(const struct timespec *timeout)
 {
-	int	rc;
+	long long	ms;
+
+	if (timeout == NULL)
+		return (-1);
+
+	if (timeout->tv_sec >= INT_MAX / 1000)
+		return (INT_MAX);
+	ms = (long long)timeout->tv_sec * 1000 +
+	    (timeout->tv_nsec + 999999) / 1000000;
+
+	return (ms > INT_MAX ? INT_MAX : (int)ms);
+}
+
+/*
+ * Run the event loop until litev_break() or, if once is set, for a single
+ * wait of at most timeout.
+ */
+static int
+loop(struct litev_base *base, const struct timespec *timeout, int once)
+{
+	const struct timespec	*wait;
+	struct timespec		 ts;
+	int			 rc;
 
 	if (base == NULL)
 		return (LITEV_EINVAL);
@@ -75,12 +296,66 @@ litev_dispatch(struct litev_base *base)
 		return (LITEV_EBUSY);
 
 	base->is_dispatched = 1;
+	rc = LITEV_OK;
 	while (!base->is_quitting) {
-		if ((rc = base->ev_api.poll(base->ev_api_data)) != LITEV_OK)
-			return (rc);
+		++base->stats.niterations;
+
+		wait = timer_timeout(base, timeout, &ts);
+		rc = base->ev_api.poll(base->ev_api_data, wait);
+		if (rc != LITEV_OK)
+			break;
+		timer_run(base);
+		if (once)
+			break;
 	}
 
-	return (LITEV_OK);
+	/* Allow the event loop to be dispatched again. */
+	base->is_dispatched = 0;
+	base->is_quitting = 0;
+
+	return (rc);
+}
+
+int
+litev_dispatch(struct litev_base *base)
+{
+	return (loop(base, NULL, 0));
+}
+
+/*
+ * Run the event loop like litev_dispatch(), or only for a single wait with
+ * LITEV_ONCE.  LITEV_NOWAIT implies LITEV_ONCE, but does not wait at all.
+ */
+int
+litev_loop(struct litev_base *base, int flags)
+{
+	struct timespec	zero;
+
+	if (flags & ~(LITEV_ONCE | LITEV_NOWAIT))
+		return (LITEV_EINVAL);
+
+	if (flags & LITEV_NOWAIT) {
+		zero.tv_sec = 0;
+		zero.tv_nsec = 0;
+		return (loop(base, &zero, 1));
+	}
+
+	return (loop(base, NULL, flags & LITEV_ONCE));
+}
+
+/*
+ * Run a single wait of the event loop for at most usec microseconds and
+ * process the events that are ready by then.
+ */
+int
+litev_loop_timeout(struct litev_base *base, unsigned long long usec)
+{
+	struct timespec	timeout;
+
+	timeout.tv_sec = usec / 1000000 > INT_MAX ? INT_MAX : usec / 1000000;
+	timeout.tv_nsec = usec % 1000000 * 1000;
+
+	return (loop(base, &timeout, 1));
 }
 
 int
@@ -106,28 +381,146 @@ litev_add(struct litev_base *base, struct litev_ev *ev)
 {
 	if (base == NULL || ev == NULL || ev->fd < 0)
 		return (LITEV_EINVAL);
-	if (!(ev->condition == LITEV_READ || ev->condition == LITEV_WRITE))
+	if (!(ev->condition == LITEV_READ || ev->condition == LITEV_WRITE ||
+	    ev->condition == LITEV_ERRQUEUE))
 		return (LITEV_EINVAL);
 
-	return (base->ev_api.add(base->ev_api_data, ev));
+	TRACE(base, LITEV_TRACE_ADD, ev->fd, ev->condition);
+
+	return (ev_add(base, ev, 0, NULL));
 }
 
 int
 litev_del(struct litev_base *base, struct litev_ev *ev)
 {
+	struct litev_ev	*node;
+
 	if (base == NULL || ev == NULL || ev->fd < 0)
 		return (LITEV_EINVAL);
-	if (!(ev->condition == LITEV_READ || ev->condition == LITEV_WRITE))
+	if (!(ev->condition == LITEV_READ || ev->condition == LITEV_WRITE ||
+	    ev->condition == LITEV_ERRQUEUE))
 		return (LITEV_EINVAL);
 
-	return (base->ev_api.del(base->ev_api_data, ev));
+	TRACE(base, LITEV_TRACE_DEL, ev->fd, ev->condition);
+
+	if ((node = hash_lookup(base->hash, ev)) == NULL)
+		return (LITEV_ENOENT);
+
+	return (ev_del(base, node));
+}
+
+/*
+ * Register ev without copying it, so that ev must stay at the same address
+ * until it is removed through litev_del_intrusive(), litev_del() or
+ * litev_close().
+ */
+int
+litev_add_intrusive(struct litev_base *base, struct litev_ev *ev)
+{
+	if (base == NULL || ev == NULL || ev->fd < 0 || ev->cb == NULL)
+		return (LITEV_EINVAL);
+	if (!(ev->condition == LITEV_READ || ev->condition == LITEV_WRITE ||
+	    ev->condition == LITEV_ERRQUEUE))
+		return (LITEV_EINVAL);
+
+	TRACE(base, LITEV_TRACE_ADD, ev->fd, ev->condition);
+
+	return (ev_add(base, ev, 1, NULL));
+}
+
+/*
+ * Remove an event that has been registered through litev_add_intrusive().
+ * The link of ev is only trusted, once the registered node of its FD and
+ * condition turns out to be ev itself, as ev may have never been added.
+ */
+int
+litev_del_intrusive(struct litev_base *base, struct litev_ev *ev)
+{
+	if (base == NULL || ev == NULL || ev->fd < 0)
+		return (LITEV_EINVAL);
+	if (!(ev->condition == LITEV_READ || ev->condition == LITEV_WRITE ||
+	    ev->condition == LITEV_ERRQUEUE))
+		return (LITEV_EINVAL);
+	if (hash_lookup(base->hash, ev) != ev)
+		return (LITEV_ENOENT);
+
+	TRACE(base, LITEV_TRACE_DEL, ev->fd, ev->condition);
+
+	return (ev_del(base, ev));
 }
 
 int
 litev_close(struct litev_base *base, int fd)
 {
+	struct litev_ev	*node;
+	struct litev_ev	 ev;
+	short		 conditions[] = {
+		LITEV_READ, LITEV_WRITE, LITEV_ERRQUEUE
+	};
+	size_t		 i;
+	int		 rc;
+
 	if (base == NULL || fd < 0)
 		return (LITEV_EINVAL);
 
-	return (base->ev_api.close(base->ev_api_data, fd));
+	TRACE(base, LITEV_TRACE_CLOSE, fd, 0);
+
+	listener_close(base, fd);
+	rl_close(base, fd);
+
+	rc = base->ev_api.close(base->ev_api_data, fd);
+
+	/* The kernel forgets about the FD on its own. */
+	ev.fd = fd;
+	for (i = 0; i < sizeof(conditions) / sizeof(conditions[0]); ++i) {
+		ev.condition = conditions[i];
+		if ((node = hash_lookup(base->hash, &ev)) != NULL)
+			hash_del(base, base->hash, node);
+	}
+
+	return (rc);
+}
+
+const char *
+litev_backend_name(struct litev_base *base)
+{
+	if (base == NULL)
+		return (NULL);
+
+	return (base->ev_api.name);
+}
+
+/*
+ * Return the FD of the kernel object of the backend, which becomes readable
+ * whenever events are ready, so that the base can be serviced from another
+ * event loop through litev_loop() with LITEV_NOWAIT.  poll(2) has no such FD,
+ * hence -1 is returned for it.
+ */
+int
+litev_backend_fd(struct litev_base *base)
+{
+	if (base == NULL)
+		return (-1);
+
+	return (base->ev_api.fd(base->ev_api_data));
+}
+
+const char *
+litev_backend_at(size_t i)
+{
+	if (i >= sizeof(backends) / sizeof(backends[0]))
+		return (NULL);
+
+	return (backends[i].name);
+}
+
+int
+litev_stats(struct litev_base *base, struct litev_stats *stats)
+{
+	if (base == NULL || stats == NULL)
+		return (LITEV_EINVAL);
+
+	memcpy(stats, &base->stats, sizeof(struct litev_stats));
+
+	return (LITEV_OK);
 }
@@ -17,15 +17,30 @@
 #ifndef LITEV_H
 #define LITEV_H
 
+/* For pid_t and size_t. */
+#include <sys/types.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 #define LITEV_READ	1
 #define LITEV_WRITE	2
+#define LITEV_ERRQUEUE	4
+
+/* Flags of litev_loop(). */
+#define LITEV_ONCE	1
+#define LITEV_NOWAIT	2
 
 struct litev_base;
+struct litev_bp;
+struct litev_chan;
 struct litev_ev;
+struct litev_zc;
+struct litev_dgram;
+struct litev_rl;
+struct litev_timer;
+struct sockaddr;
 
 enum {
 	LITEV_OK = 0,
@@ -35,26 +50,334 @@ enum {
 	LITEV_EINVAL,
 	LITEV_EAGAIN,
 	LITEV_EALREADY,
-	LITEV_EOVERFLOW
+	LITEV_EOVERFLOW,
+	LITEV_ENOTSUP
+};
+
+/*
+ * Reserved for litev, the link of a registered event into its base.  It does
+ * not need to be initialized by the caller.
+ */
+struct litev_ev_link {
+	struct litev_ev	*prev;
+	struct litev_ev	*next;
+	size_t		 idx;
+	unsigned int	 handle;
+	unsigned char	 is_enabled;
+	unsigned char	 is_intrusive;
+	unsigned char	 is_throttled;
 };
 
 struct litev_ev {
-	int	  fd;
-	short	  condition;
+	int			  fd;
+	short			  condition;
+	void			(*cb)(int, short, void *);
+	void			 *udata;
+
+	struct litev_ev_link	  link;
+};
+
+/*
+ * A timer, which must stay at the same address while it is armed.  Its slack
+ * in microseconds is the time by which it may fire late, so that it can share
+ * a wakeup with other timers.  The remaining members are reserved for litev
+ * and set up by litev_timer_init().
+ */
+struct litev_timer {
+	void			(*cb)(void *);
+	void			 *udata;
+	unsigned long long	  slack;
+
+	unsigned long long	  deadline;
+	unsigned long long	  latest;
+	size_t			  idx;
+};
+
+/*
+ * Bucket 0 of the nready histogram counts the waits that returned no events,
+ * bucket i counts the waits that returned between 2^(i - 1) and 2^i - 1
+ * events and the last bucket also counts all waits beyond that.
+ */
+#define LITEV_STATS_NREADY	16
+
+/*
+ * Histograms of durations in nanoseconds, see latency.c for the layout of
+ * the buckets.
+ */
+#define LITEV_HIST_SUBBITS	3
+#define LITEV_HIST_MAXBIT	39
+#define LITEV_HIST_NBUCKETS	\
+	((LITEV_HIST_MAXBIT - LITEV_HIST_SUBBITS + 2) << LITEV_HIST_SUBBITS)
+
+/* Types of the records of the event trace, see trace.c. */
+#define LITEV_TRACE_WAIT	1
+#define LITEV_TRACE_READY	2
+#define LITEV_TRACE_ADD		3
+#define LITEV_TRACE_DEL		4
+#define LITEV_TRACE_CLOSE	5
+#define LITEV_TRACE_CB_BEGIN	6
+#define LITEV_TRACE_CB_END	7
+
+#define LITEV_ARENA_PREFAULT	1
+#define LITEV_ARENA_MLOCK	2
+
+struct litev_allocator {
+	void	*(*malloc)(void *, size_t);
+	void	*(*realloc)(void *, void *, size_t);
+	void	 (*free)(void *, void *);
+	void	 *ctx;
+};
+
+struct litev_opts {
+	const struct litev_allocator	*allocator;
+	const char			*backend;
+	size_t				 arena_size;
+	int				 arena_flags;
+};
+
+struct litev_stats {
+	unsigned long long	niterations;
+	unsigned long long	nwakeups_empty;
+	unsigned long long	nready[LITEV_STATS_NREADY];
+	unsigned long long	ncb_read;
+	unsigned long long	ncb_write;
+	unsigned long long	ncb_errqueue;
+	unsigned long long	nctl;
+	unsigned long long	ngrow;
+	unsigned long long	ntimers;
+	unsigned long long	nwakeups_saved;
+	size_t			nbytes_hash;
+	size_t			nbytes_ev;
+};
+
+struct litev_hist {
+	unsigned long long	count;
+	unsigned long long	max;
+	unsigned long long	buckets[LITEV_HIST_NBUCKETS];
+};
+
+/*
+ * Refers to a registered event until it is removed, including through
+ * litev_close(), after which the handle is stale.
+ */
+struct litev_handle {
+	unsigned int	idx;
+	unsigned int	gen;
+};
+
+struct litev_trace_hdr {
+	char			magic[8];
+	unsigned long long	tsc_hz;
+	unsigned long long	nrec;
+};
+
+struct litev_trace_rec {
+	unsigned long long	tsc;
+	int			arg;
+	unsigned short		type;
+	short			condition;
+};
+
+struct litev_rl_opts {
+	unsigned long long	read_rate;
+	unsigned long long	read_burst;
+	unsigned long long	write_rate;
+	unsigned long long	write_burst;
+};
+
+struct litev_listener_opts {
+	size_t	  budget;
 	void	(*cb)(int, short, void *);
 	void	 *udata;
+	void	(*err_cb)(int, int, void *);
+};
+
+struct litev_dgram_msg {
+	void		*buf;
+	size_t		 len;
+	struct sockaddr	*addr;
+	size_t		 addrlen;
 };
 
 struct litev_base	*litev_init(void);
+struct litev_base	*litev_init_ex(const struct litev_opts *);
+struct litev_base	*litev_init_backend(const char *);
 void			 litev_free(struct litev_base **);
+int			 litev_reinit_after_fork(struct litev_base *);
 
 int			 litev_dispatch(struct litev_base *);
 int			 litev_break(struct litev_base *);
+int			 litev_loop(struct litev_base *, int);
+int			 litev_loop_timeout(struct litev_base *,
+			    unsigned long long);
 
 int			 litev_add(struct litev_base *, struct litev_ev *);
 int			 litev_del(struct litev_base *, struct litev_ev *);
 int			 litev_close(struct litev_base *, int);
 
+int			 litev_add_intrusive(struct litev_base *,
+			    struct litev_ev *);
+int			 litev_del_intrusive(struct litev_base *,
+			    struct litev_ev *);
+
+int			 litev_add_handle(struct litev_base *,
+			    struct litev_ev *, struct litev_handle *);
+int			 litev_del_handle(struct litev_base *,
+			    const struct litev_handle *);
+int			 litev_modify_handle(struct litev_base *,
+			    const struct litev_handle *,
+			    void (*)(int, short, void *), void *);
+int			 litev_enable(struct litev_base *,
+			    const struct litev_handle *);
+int			 litev_disable(struct litev_base *,
+			    const struct litev_handle *);
+
+/*
+ * Timers that fire once, with a slack per timer and a minimum slack per
+ * base.  Timers whose slack windows overlap are fired in the same wakeup.
+ */
+void			 litev_timer_init(struct litev_timer *,
+			    void (*)(void *), void *);
+int			 litev_timer_add(struct litev_base *,
+			    struct litev_timer *, unsigned long long);
+int			 litev_timer_del(struct litev_base *,
+			    struct litev_timer *);
+int			 litev_timer_pending(const struct litev_timer *);
+int			 litev_timer_slack(struct litev_base *,
+			    unsigned long long);
+
+/*
+ * Watch a child process until it exits, upon which it is reaped and the
+ * callback receives its PID and the si_code and si_status of waitid(2).
+ * A si_code of zero means that waitid(2) failed with si_status as errno.
+ */
+int			 litev_child_add(struct litev_base *, pid_t,
+			    void (*)(pid_t, int, int, void *), void *);
+int			 litev_child_del(struct litev_base *, pid_t);
+
+const char		*litev_backend_name(struct litev_base *);
+int			 litev_backend_fd(struct litev_base *);
+const char		*litev_backend_at(size_t);
+
+int			 litev_stats(struct litev_base *,
+			    struct litev_stats *);
+
+/*
+ * Report an event as ready to a base with the "null" backend, which never
+ * asks the kernel about readiness, for tests and for measuring the overhead
+ * of litev itself.
+ */
+int			 litev_null_inject(struct litev_base *, int, short);
+
+/*
+ * Record the duration of every callback per callback function and the time
+ * spent waiting inside the kernel.  Callbacks that take threshold or more
+ * nanoseconds are reported to the hook, unless threshold is zero.
+ */
+int			 litev_latency_enable(struct litev_base *,
+			    unsigned long long, void (*)(int, short,
+			    unsigned long long, void *), void *);
+void			 litev_latency_disable(struct litev_base *);
+int			 litev_latency_cb(struct litev_base *,
+			    void (*)(int, short, void *), struct litev_hist *);
+int			 litev_latency_wait(struct litev_base *,
+			    struct litev_hist *);
+void			 litev_hist_record(struct litev_hist *,
+			    unsigned long long);
+unsigned long long	 litev_hist_quantile(const struct litev_hist *,
+			    double);
+
+/* Only available, if litev has been compiled with -DLITEV_TRACE. */
+int			 litev_trace_dump(struct litev_base *, const char *);
+
+/*
+ * Accept connections on a listening socket in batches of up to budget
+ * connections per wakeup, zero meaning until EAGAIN.  New connections are
+ * non-blocking and registered for LITEV_READ with cb, if cb is not NULL.
+ * If accepting fails for a lack of FDs or memory, the listener stops until
+ * litev_listener_resume() and err_cb, if not NULL, is called with the FD of
+ * the listener and the errno.
+ */
+int			 litev_listener_add(struct litev_base *, int,
+			    void (*)(int, void *),
+			    const struct litev_listener_opts *);
+int			 litev_listener_del(struct litev_base *, int);
+int			 litev_listener_resume(struct litev_base *, int);
+
+/*
+ * Create a group of listening sockets with SO_REUSEPORT, one per base, to
+ * which connections are steered by the CPU that received them.
+ */
+int			 litev_listener_group(const struct sockaddr *, size_t,
+			    int, int *, size_t);
+int			 litev_pin_cpu(int);
+
+/*
+ * Token buckets that limit the bytes per second read from and written to a
+ * group of FDs, which are reported through litev_rl_consume().  While a
+ * bucket is empty, the events of its condition are taken out of the kernel
+ * for all FDs of the group.
+ */
+struct litev_rl		*litev_rl_init(struct litev_base *,
+			    const struct litev_rl_opts *);
+void			 litev_rl_free(struct litev_rl **);
+int			 litev_rl_add(struct litev_rl *, int);
+int			 litev_rl_del(struct litev_rl *, int);
+size_t			 litev_rl_avail(struct litev_rl *, short);
+int			 litev_rl_consume(struct litev_rl *, short, size_t);
+
+/*
+ * Backpressure for proxying from an upstream event, whose handle is passed,
+ * into an outbound buffer, of which the caller reports every change.  The
+ * upstream event is disabled above the high and enabled again at or below
+ * the low watermark of queued bytes.
+ */
+struct litev_bp		*litev_bp_init(struct litev_base *,
+			    const struct litev_handle *, size_t, size_t);
+void			 litev_bp_free(struct litev_bp **);
+int			 litev_bp_queue(struct litev_bp *, size_t);
+int			 litev_bp_drain(struct litev_bp *, size_t);
+size_t			 litev_bp_queued(struct litev_bp *);
+
+/*
+ * Lock-free single-producer single-consumer channels of pointers into a
+ * base, which may be fed from another thread.  The consumer is only woken
+ * up once the channel becomes non-empty and receives the messages in
+ * batches.
+ */
+struct litev_chan	*litev_chan_init(struct litev_base *, size_t,
+			    void (*)(void **, size_t, void *), void *);
+void			 litev_chan_free(struct litev_chan **);
+int			 litev_chan_send(struct litev_chan *, void *);
+
+/*
+ * Zero-copy transmission with MSG_ZEROCOPY.  The callback receives every
+ * buffer passed to a successful litev_zc_send() exactly once, as soon as the
+ * kernel no longer references it.  Buffers below the threshold are copied.
+ * A socket error that occurs while waiting for completions fails the next
+ * litev_zc_send() with -1 and errno.
+ */
+struct litev_zc		*litev_zc_init(struct litev_base *, int, size_t,
+			    void (*)(int, void *, void *));
+void			 litev_zc_free(struct litev_zc **);
+int			 litev_zc_send(struct litev_zc *, void *, size_t,
+			    void *, size_t *);
+
+/*
+ * Batched datagram I/O with recvmmsg(2) and sendmmsg(2).  Received datagrams
+ * are passed to the callback in batches, while datagrams to be sent are
+ * queued until litev_dgram_flush() or the end of the next read batch.
+ * litev_dgram_send() fails with LITEV_EAGAIN, while the queue stays full,
+ * or with -1 and errno, if flushing the queue has failed and dropped it.
+ */
+struct litev_dgram	*litev_dgram_init(struct litev_base *, int, size_t,
+			    size_t, void (*)(int, struct litev_dgram_msg *,
+			    size_t, void *), void *);
+void			 litev_dgram_free(struct litev_dgram **);
+int			 litev_dgram_send(struct litev_dgram *, const void *,
+			    size_t, const struct sockaddr *, size_t);
+int			 litev_dgram_flush(struct litev_dgram *);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2022-2024 Emil Engler <me@emilengler.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Header-only C++11 wrapper around litev.
+ *
+ * Handlers are bound through templates, so that the trampoline which is
+ * registered with litev calls them directly: there is no std::function,
+ * no heap allocation and no virtual call involved, allowing the compiler
+ * to inline the handler into the trampoline.
+ *
+ *	litev::Loop	loop;
+ *	auto		w = litev::watch(loop, fd, LITEV_READ,
+ *			    [&](int fd, short condition) { ... });
+ *
+ *	w.start();
+ *	loop.dispatch();
+ *
+ * A Watcher is registered under its own address, hence moving an active
+ * Watcher re-registers it at its new address.
+ */
+
+#ifndef LITEV_HPP
+#define LITEV_HPP
+
+#include <stdexcept>
+#include <utility>
+
+#include "litev.h"
+
+namespace litev {
+
+class Loop {
+public:
+	Loop() : base_(litev_init())
+	{
+		if (base_ == nullptr)
+			throw std::runtime_error("litev_init");
+	}
+
+	explicit Loop(const char *backend) : base_(litev_init_backend(backend))
+	{
+		if (base_ == nullptr)
+			throw std::runtime_error("litev_init_backend");
+	}
+
+	explicit Loop(const struct litev_opts &opts)
+	    : base_(litev_init_ex(&opts))
+	{
+		if (base_ == nullptr)
+			throw std::runtime_error("litev_init_ex");
+	}
+
+	~Loop()
+	{
+		litev_free(&base_);
+	}
+
+	Loop(const Loop &) = delete;
+	Loop &operator=(const Loop &) = delete;
+
+	Loop(Loop &&o) noexcept : base_(o.base_)
+	{
+		o.base_ = nullptr;
+	}
+
+	Loop &
+	operator=(Loop &&o) noexcept
+	{
+		if (this != &o) {
+			litev_free(&base_);
+			base_ = o.base_;
+			o.base_ = nullptr;
+		}
+		return (*this);
+	}
+
+	int
+	dispatch()
+	{
+		return (litev_dispatch(base_));
+	}
+
+	int
+	loop(int flags)
+	{
+		return (litev_loop(base_, flags));
+	}
+
+	int
+	loop_timeout(unsigned long long usec)
+	{
+		return (litev_loop_timeout(base_, usec));
+	}
+
+	/* break is a keyword. */
+	int
+	stop()
+	{
+		return (litev_break(base_));
+	}
+
+	int
+	close(int fd)
+	{
+		return (litev_close(base_, fd));
+	}
+
+	const char *
+	backend() const
+	{
+		return (litev_backend_name(base_));
+	}
+
+	struct litev_base *
+	get() const
+	{
+		return (base_);
+	}
+
+private:
+	struct litev_base	*base_;
+};
+
+/*
+ * Calls the member function M of an object, for use as a handler.
+ */
+template <typename T, void (T::*M)(int, short)>
+struct Member {
+	T	*obj;
+
+	void
+	operator()(int fd, short condition) const
+	{
+		(obj->*M)(fd, condition);
+	}
+};
+
+template <typename T, void (T::*M)(int, short)>
+Member<T, M>
+member(T *obj)
+{
+	return (Member<T, M>{obj});
+}
+
+/*
+ * A registration of F for condition on fd, which is removed on
+ * destruction.  F is invoked as f(fd, condition).
+ */
+template <typename F>
+class Watcher {
+public:
+	Watcher(Loop &loop, int fd, short condition, F f)
+	    : base_(loop.get()), ev_(), f_(std::move(f))
+	{
+		ev_.fd = fd;
+		ev_.condition = condition;
+	}
+
+	~Watcher()
+	{
+		stop();
+	}
+
+	Watcher(const Watcher &) = delete;
+	Watcher &operator=(const Watcher &) = delete;
+
+	/* Closures, such as capturing lambdas, cannot be assigned. */
+	Watcher &operator=(Watcher &&) = delete;
+
+	Watcher(Watcher &&o)
+	    : base_(o.base_), ev_(), f_(std::move(o.f_))
+	{
+		ev_.fd = o.ev_.fd;
+		ev_.condition = o.ev_.condition;
+		if (o.active()) {
+			o.stop();
+			start();
+		}
+	}
+
+	/* The event of the Watcher itself is registered, see litev.h. */
+	int
+	start()
+	{
+		if (active())
+			return (LITEV_EEXIST);
+
+		ev_.cb = trampoline;
+		ev_.udata = this;
+		return (litev_add_intrusive(base_, &ev_));
+	}
+
+	/* The event is already gone if the FD went through litev_close(). */
+	int
+	stop()
+	{
+		return (litev_del_intrusive(base_, &ev_));
+	}
+
+	bool
+	active() const
+	{
+		return (ev_.link.is_intrusive != 0);
+	}
+
+	int
+	fd() const
+	{
+		return (ev_.fd);
+	}
+
+	F &
+	handler()
+	{
+		return (f_);
+	}
+
+private:
+	static void
+	trampoline(int fd, short condition, void *udata)
+	{
+		static_cast<Watcher *>(udata)->f_(fd, condition);
+	}
+
+	struct litev_base	*base_;
+	struct litev_ev		 ev_;
+	F			 f_;
+};
+
+/*
+ * Deduce the type of the handler, notably for lambdas.
+ */
+template <typename F>
+Watcher<F>
+watch(Loop &loop, int fd, short condition, F f)
+{
+	return (Watcher<F>(loop, fd, condition, std::move(f)));
+}
+
+}
+
+#endif
@@ -0,0 +1,258 @@
+/*
+ * Copyright (c) 2022-2024 Emil Engler <me@emilengler.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "litev.h"
+#include "litev-internal.h"
+#include "mem.h"
+
+/*
+ * Every block inside an arena is preceded by a header of ARENA_ALIGN bytes,
+ * which stores the size class of the block.  Blocks of size class i are
+ * 2^i bytes large including the header, so the smallest block is
+ * 2^ARENA_MINCLASS bytes large.
+ *
+ * New blocks are carved from the arena by bumping the next pointer.  Freed
+ * blocks are put on the free list of their size class, from which they are
+ * reused by later allocations of the same size class.  The arena itself is
+ * only returned to the allocator in mem_fini(), all at once.
+ */
+#define ARENA_ALIGN	16
+#define ARENA_MINCLASS	5
+
+static void	*libc_malloc(void *, size_t);
+static void	*libc_realloc(void *, void *, size_t);
+static void	 libc_free(void *, void *);
+
+static void	*arena_alloc(struct litev_arena *, size_t);
+static size_t	 arena_class(size_t);
+static int	 arena_contains(struct litev_arena *, void *);
+static void	 arena_free(struct litev_arena *, void *);
+
+static const struct litev_allocator	libc_allocator = {
+	libc_malloc, libc_realloc, libc_free, NULL
+};
+
+static void *
+libc_malloc(void *ctx, size_t size)
+{
+	return (malloc(size));
+}
+
+static void *
+libc_realloc(void *ctx, void *ptr, size_t size)
+{
+	return (realloc(ptr, size));
+}
+
+static void
+libc_free(void *ctx, void *ptr)
+{
+	free(ptr);
+}
+
+static void *
+arena_alloc(struct litev_arena *arena, size_t size)
+{
+	unsigned char	*block;
+	void		*ptr;
+	size_t		 class;
+
+	if (arena->start == NULL || (class = arena_class(size)) == 0)
+		return (NULL);
+
+	/* Reuse a freed block of the same size class. */
+	if ((ptr = arena->freelist[class]) != NULL) {
+		memcpy(&arena->freelist[class], ptr, sizeof(void *));
+		return (ptr);
+	}
+
+	if ((size_t)(arena->end - arena->next) < (size_t)1 << class)
+		return (NULL);
+	block = arena->next;
+	arena->next += (size_t)1 << class;
+
+	memcpy(block, &class, sizeof(class));
+
+	return (block + ARENA_ALIGN);
+}
+
+/*
+ * Return the size class of a block that can hold size bytes or zero, if
+ * there is none.
+ */
+static size_t
+arena_class(size_t size)
+{
+	size_t	class;
+
+	if (size > SIZE_MAX - ARENA_ALIGN)
+		return (0);
+	size += ARENA_ALIGN;
+
+	for (class = ARENA_MINCLASS; class < ARENA_NCLASS; ++class) {
+		if (((size_t)1 << class) >= size)
+			return (class);
+	}
+
+	return (0);
+}
+
+static int
+arena_contains(struct litev_arena *arena, void *ptr)
+{
+	uintptr_t	p;
+
+	p = (uintptr_t)ptr;
+
+	return (p >= (uintptr_t)arena->start && p < (uintptr_t)arena->end);
+}
+
+static void
+arena_free(struct litev_arena *arena, void *ptr)
+{
+	size_t	class;
+
+	memcpy(&class, (unsigned char *)ptr - ARENA_ALIGN, sizeof(class));
+
+	memcpy(ptr, &arena->freelist[class], sizeof(void *));
+	arena->freelist[class] = ptr;
+}
+
+int
+mem_init(struct litev_base *base, const struct litev_opts *opts)
+{
+	struct litev_arena	*arena;
+	size_t			 size;
+
+	arena = &base->arena;
+	memset(arena, 0, sizeof(struct litev_arena));
+
+	if (opts != NULL && opts->allocator != NULL)
+		base->allocator = *opts->allocator;
+	else
+		base->allocator = libc_allocator;
+
+	if (opts == NULL || opts->arena_size == 0)
+		return (LITEV_OK);
+
+	/* Round the arena down to full blocks of the smallest size class. */
+	size = opts->arena_size & ~(((size_t)1 << ARENA_MINCLASS) - 1);
+	if (size == 0)
+		return (LITEV_EINVAL);
+
+	arena->start = base->allocator.malloc(base->allocator.ctx, size);
+	if (arena->start == NULL)
+		return (-1);
+	arena->end = arena->start + size;
+	arena->next = arena->start;
+	arena->flags = opts->arena_flags;
+
+	/* Touching every page forces the kernel to back it right now. */
+	if (arena->flags & LITEV_ARENA_PREFAULT)
+		memset(arena->start, 0, size);
+
+	if (arena->flags & LITEV_ARENA_MLOCK) {
+		if (mlock(arena->start, size) == -1) {
+			base->allocator.free(base->allocator.ctx,
+			    arena->start);
+			arena->start = NULL;
+			return (-1);
+		}
+	}
+
+	return (LITEV_OK);
+}
+
+void
+mem_fini(struct litev_base *base)
+{
+	struct litev_arena	*arena;
+
+	arena = &base->arena;
+	if (arena->start == NULL)
+		return;
+
+	if (arena->flags & LITEV_ARENA_MLOCK)
+		munlock(arena->start, arena->end - arena->start);
+	base->allocator.free(base->allocator.ctx, arena->start);
+	arena->start = NULL;
+}
+
+void *
+mem_malloc(struct litev_base *base, size_t size)
+{
+	void	*ptr;
+
+	if ((ptr = arena_alloc(&base->arena, size)) != NULL)
+		return (ptr);
+
+	return (base->allocator.malloc(base->allocator.ctx, size));
+}
+
+/*
+ * Resize ptr to an array of nmemb elements of size bytes each, checking for
+ * integer overflows.
+ */
+void *
+mem_reallocarray(struct litev_base *base, void *ptr, size_t nmemb,
+    size_t size)
+{
+	void	*n_ptr;
+	size_t	 class;
+
+	if (size != 0 && nmemb > SIZE_MAX / size)
+		return (NULL);
+	size *= nmemb;
+
+	if (ptr == NULL)
+		return (mem_malloc(base, size));
+	if (!arena_contains(&base->arena, ptr))
+		return (base->allocator.realloc(base->allocator.ctx, ptr,
+		    size));
+
+	/* The block might already be large enough. */
+	memcpy(&class, (unsigned char *)ptr - ARENA_ALIGN, sizeof(class));
+	if (size <= ((size_t)1 << class) - ARENA_ALIGN)
+		return (ptr);
+
+	if ((n_ptr = mem_malloc(base, size)) == NULL)
+		return (NULL);
+	memcpy(n_ptr, ptr, ((size_t)1 << class) - ARENA_ALIGN);
+	arena_free(&base->arena, ptr);
+
+	return (n_ptr);
+}
+
+void
+mem_free(struct litev_base *base, void *ptr)
+{
+	if (ptr == NULL)
+		return;
+
+	if (arena_contains(&base->arena, ptr))
+		arena_free(&base->arena, ptr);
+	else
+		base->allocator.free(base->allocator.ctx, ptr);
+}
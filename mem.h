@@ -0,0 +1,31 @@
+/*
+ * Copyright (c) 2022-2024 Emil Engler <me@emilengler.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef MEM_H
+#define MEM_H
+
+/*
+ * All memory of a base is allocated through these functions, which use the
+ * arena of the base first and fall back to its allocator.
+ */
+int	 mem_init(struct litev_base *, const struct litev_opts *);
+void	 mem_fini(struct litev_base *);
+
+void	*mem_malloc(struct litev_base *, size_t);
+void	*mem_reallocarray(struct litev_base *, void *, size_t, size_t);
+void	 mem_free(struct litev_base *, void *);
+
+#endif
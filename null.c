@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2022-2024 Emil Engler <me@emilengler.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Required for nanosleep(2). */
+#define _POSIX_C_SOURCE	200809L
+
+#include "config.h"
+
+#include <sys/types.h>
+
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "litev.h"
+#include "litev-internal.h"
+#include "ev_api.h"
+#include "hash.h"
+#include "mem.h"
+
+#define GROW	128
+
+/*
+ * The null backend never asks the kernel about readiness.  Instead, the
+ * readiness of enabled nodes is injected through litev_null_inject() into
+ * the ready queue, which the next poll delivers in the order of injection.
+ * The idx of a queued node is its index inside ready plus one and zero for
+ * all other nodes, so that a removal only leaves a NULL slot behind.
+ */
+struct null_data {
+	struct litev_base	 *base;
+	struct litev_ev		**ready;
+	size_t			  nready;
+	size_t			  maxready;
+	size_t			  nqueued;	/* Slots other than NULL. */
+};
+
+static void		 null_unqueue(struct null_data *, struct litev_ev *);
+
+static EV_API_DATA	*null_init(struct litev_base *);
+static void		 null_free(EV_API_DATA *);
+static int		 null_poll(EV_API_DATA *, const struct timespec *);
+static int		 null_reinit(EV_API_DATA *);
+static int		 null_fd(EV_API_DATA *);
+static int		 null_add(EV_API_DATA *, struct litev_ev *);
+static int		 null_del(EV_API_DATA *, struct litev_ev *);
+static int		 null_close(EV_API_DATA *, int);
+
+static void
+null_unqueue(struct null_data *data, struct litev_ev *node)
+{
+	if (node->link.idx == 0)
+		return;
+
+	data->ready[node->link.idx - 1] = NULL;
+	node->link.idx = 0;
+	--data->nqueued;
+}
+
+static EV_API_DATA *
+null_init(struct litev_base *base)
+{
+	struct null_data	*data;
+
+	if ((data = mem_malloc(base, sizeof(struct null_data))) == NULL)
+		return (NULL);
+	data->base = base;
+	data->ready = NULL;
+	data->nready = 0;
+	data->maxready = 0;
+	data->nqueued = 0;
+
+	return (data);
+}
+
+static void
+null_free(EV_API_DATA *raw_data)
+{
+	struct null_data	*data;
+
+	data = raw_data;
+
+	mem_free(data->base, data->ready);
+	data->base->stats.nbytes_ev -= sizeof(struct litev_ev *) *
+	    data->maxready;
+
+	mem_free(data->base, data);
+}
+
+/*
+ * Deliver the nodes that have been injected before the poll, while those
+ * injected by the callbacks wait for the next one.  With nothing to
+ * deliver, the poll sleeps until timeout, so that timers keep working, or
+ * returns at once if there is none.
+ */
+static int
+null_poll(EV_API_DATA *raw_data, const struct timespec *timeout)
+{
+	struct null_data	*data;
+	struct litev_ev		*node;
+	size_t			 i, n, w;
+
+	data = raw_data;
+
+	ev_wait(data->base);
+	if (data->nqueued == 0 && timeout != NULL &&
+	    (timeout->tv_sec != 0 || timeout->tv_nsec != 0))
+		nanosleep(timeout, NULL);
+	ev_ready(data->base, data->nqueued > INT_MAX ? INT_MAX :
+	    (int)data->nqueued);
+
+	/* data->ready may be moved by the callbacks. */
+	n = data->nready;
+	for (i = 0; i < n; ++i) {
+		if ((node = data->ready[i]) == NULL)
+			continue;
+		null_unqueue(data, node);
+		ev_cb(data->base, node);
+	}
+
+	/*
+	 * Move the nodes injected by the callbacks to the front, dropping
+	 * the slots of those that have been removed in the meantime.
+	 */
+	w = 0;
+	for (i = n; i < data->nready; ++i) {
+		if ((node = data->ready[i]) != NULL) {
+			data->ready[w++] = node;
+			node->link.idx = w;
+		}
+	}
+	data->nready = w;
+
+	return (LITEV_OK);
+}
+
+/*
+ * There is no kernel object, the ready queue is private to the process.
+ */
+static int
+null_reinit(EV_API_DATA *raw_data)
+{
+	return (LITEV_OK);
+}
+
+static int
+null_fd(EV_API_DATA *raw_data)
+{
+	return (-1);
+}
+
+static int
+null_add(EV_API_DATA *raw_data, struct litev_ev *node)
+{
+	node->link.idx = 0;
+
+	return (LITEV_OK);
+}
+
+static int
+null_del(EV_API_DATA *raw_data, struct litev_ev *node)
+{
+	null_unqueue(raw_data, node);
+
+	return (LITEV_OK);
+}
+
+/*
+ * Like the other backends, the FD is closed, hence FDs that are made up by
+ * a benchmark must not be passed to litev_close().
+ */
+static int
+null_close(EV_API_DATA *raw_data, int fd)
+{
+	struct null_data	*data;
+	struct litev_ev		*node;
+	struct litev_ev		 ev;
+	short			 conditions[] = {
+		LITEV_READ, LITEV_WRITE, LITEV_ERRQUEUE
+	};
+	size_t			 i;
+
+	data = raw_data;
+	ev.fd = fd;
+
+	for (i = 0; i < sizeof(conditions) / sizeof(conditions[0]); ++i) {
+		ev.condition = conditions[i];
+		if ((node = hash_lookup(data->base->hash, &ev)) != NULL)
+			null_unqueue(data, node);
+	}
+
+	return (close(fd) == 0 ? LITEV_OK : -1);
+}
+
+void
+ev_api_null(struct litev_ev_api *ev_api)
+{
+	ev_api->name = "null";
+	ev_api->init = null_init;
+	ev_api->free = null_free;
+	ev_api->poll = null_poll;
+	ev_api->reinit = null_reinit;
+	ev_api->fd = null_fd;
+	ev_api->add = null_add;
+	ev_api->del = null_del;
+	ev_api->close = null_close;
+}
+
+/*
+ * Report the enabled event of condition on fd as ready to the next poll of
+ * a base with the null backend.  An event is queued at most once.
+ */
+int
+litev_null_inject(struct litev_base *base, int fd, short condition)
+{
+	struct null_data	*data;
+	struct litev_ev		*node, **n_ready;
+	struct litev_ev		 ev;
+	size_t			 n_maxready;
+
+	if (base == NULL || fd < 0)
+		return (LITEV_EINVAL);
+	if (base->ev_api.init != null_init)
+		return (LITEV_ENOTSUP);
+	data = base->ev_api_data;
+
+	ev.fd = fd;
+	ev.condition = condition;
+	node = hash_lookup(base->hash, &ev);
+	if (node == NULL || !node->link.is_enabled)
+		return (LITEV_ENOENT);
+	if (node->link.idx != 0)
+		return (LITEV_EALREADY);
+
+	if (data->nready == data->maxready) {
+		if (SIZE_MAX - GROW < data->maxready)
+			return (LITEV_EOVERFLOW);
+		n_maxready = data->maxready + GROW;
+		n_ready = mem_reallocarray(base, data->ready, n_maxready,
+		    sizeof(struct litev_ev *));
+		if (n_ready == NULL)
+			return (-1);
+		data->ready = n_ready;
+		data->maxready = n_maxready;
+
+		++base->stats.ngrow;
+		base->stats.nbytes_ev += sizeof(struct litev_ev *) * GROW;
+	}
+
+	data->ready[data->nready++] = node;
+	node->link.idx = data->nready;
+	++data->nqueued;
+
+	return (LITEV_OK);
+}
@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) 2022-2024 Emil Engler <me@emilengler.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Measure the cost of adding, dispatching, removing and closing events at
+ * various amounts of registrations, for every backend.  Every socket of a
+ * socketpair(2) is registered for reading and writing and has data waiting
+ * to be read, so that every registration is ready on every wakeup.
+ *
+ * The results are printed as tab-separated values, one line per backend,
+ * operation and size, with the average and the quantiles of the latency of
+ * a single operation in nanoseconds.  A single dispatch operation is one
+ * run of the loop until all registrations have been reported once.
+ *
+ * The null backend has all registrations injected as ready before every
+ * dispatch operation, so that its results are the overhead of litev alone.
+ */
+
+/* Required for clock_gettime(2). */
+#define _POSIX_C_SOURCE	200809L
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "litev.h"
+
+/* The amount of callbacks to aim for in the dispatch phase of each size. */
+#define DISPATCH_NCB	2000000
+
+static void			churn(struct litev_base *, size_t);
+static int			cmp(const void *, const void *);
+static void			dispatch_cb(int, short, void *);
+static unsigned long long	now(void);
+static void			report(size_t, const char *,
+				    unsigned long long *, size_t);
+
+static const size_t	sizes[] = { 10, 1000, 100000, 1000000 };
+
+static struct litev_base	*base;
+static size_t			 ncb, target;
+
+static void
+dispatch_cb(int fd, short condition, void *udata)
+{
+	if (++ncb == target)
+		litev_break(base);
+}
+
+static int
+cmp(const void *a, const void *b)
+{
+	unsigned long long	x, y;
+
+	x = *(const unsigned long long *)a;
+	y = *(const unsigned long long *)b;
+
+	return (x < y ? -1 : x > y);
+}
+
+static unsigned long long
+now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+/*
+ * Print the statistics of the n latencies in lat, which get sorted.
+ */
+static void
+report(size_t size, const char *op, unsigned long long *lat, size_t n)
+{
+	unsigned long long	sum;
+	size_t			i;
+
+	for (i = 0, sum = 0; i < n; ++i)
+		sum += lat[i];
+	qsort(lat, n, sizeof(unsigned long long), cmp);
+
+	printf("%s\t%zu\t%s\t%zu\t%.1f\t%llu\t%llu\t%llu\n",
+	    litev_backend_name(base), size, op, n, (double)sum / n, lat[n / 2],
+	    lat[n - n / 100 - 1], lat[n - 1]);
+}
+
+static void
+churn(struct litev_base *b, size_t size)
+{
+	struct litev_ev		 ev;
+	unsigned long long	*lat, t;
+	size_t			 i, j, nfd, nround;
+	int			*fds, is_null, rc;
+
+	/* Two registrations per FD, two FDs per socketpair(2). */
+	nfd = (size + 3) / 4 * 2;
+	nround = DISPATCH_NCB / size;
+	if (nround == 0)
+		nround = 1;
+
+	if ((fds = calloc(nfd, sizeof(int))) == NULL)
+		err(1, "calloc");
+	if ((lat = calloc(size > nround ? size : nround,
+	    sizeof(unsigned long long))) == NULL)
+		err(1, "calloc");
+
+	for (i = 0; i < nfd; i += 2) {
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, &fds[i]) == -1)
+			err(1, "socketpair");
+		if (write(fds[i], "x", 1) != 1 ||
+		    write(fds[i + 1], "x", 1) != 1)
+			err(1, "write");
+	}
+
+	ev.cb = dispatch_cb;
+	ev.udata = NULL;
+
+	/* Adding */
+	for (i = 0, t = now(); i < size; ++i) {
+		ev.fd = fds[i / 2];
+		ev.condition = i % 2 ? LITEV_WRITE : LITEV_READ;
+		if (litev_add(b, &ev) != LITEV_OK)
+			errx(1, "litev_add");
+		lat[i] = now() - t;
+		t += lat[i];
+	}
+	report(size, "add", lat, size);
+
+	/* Dispatching */
+	is_null = strcmp(litev_backend_name(b), "null") == 0;
+	for (i = 0; i < nround; ++i) {
+		for (j = 0; is_null && j < size; ++j) {
+			rc = litev_null_inject(b, fds[j / 2],
+			    j % 2 ? LITEV_WRITE : LITEV_READ);
+			/* Some are left over from the previous round. */
+			if (rc != LITEV_OK && rc != LITEV_EALREADY)
+				errx(1, "litev_null_inject");
+		}
+
+		ncb = 0;
+		target = size;
+		t = now();
+		if (litev_dispatch(b) != LITEV_OK)
+			errx(1, "litev_dispatch");
+		lat[i] = now() - t;
+	}
+	report(size, "dispatch", lat, nround);
+
+	/* Deleting */
+	for (i = 0, t = now(); i < size; ++i) {
+		ev.fd = fds[i / 2];
+		ev.condition = i % 2 ? LITEV_WRITE : LITEV_READ;
+		if (litev_del(b, &ev) != LITEV_OK)
+			errx(1, "litev_del");
+		lat[i] = now() - t;
+		t += lat[i];
+	}
+	report(size, "del", lat, size);
+
+	/*
+	 * Closing, which removes both registrations of a FD at once and
+	 * closes the FD itself.
+	 */
+	for (i = 0; i < size; ++i) {
+		ev.fd = fds[i / 2];
+		ev.condition = i % 2 ? LITEV_WRITE : LITEV_READ;
+		if (litev_add(b, &ev) != LITEV_OK)
+			errx(1, "litev_add");
+	}
+	for (i = 0, t = now(); i < (size + 1) / 2; ++i) {
+		if (litev_close(b, fds[i]) != LITEV_OK)
+			errx(1, "litev_close");
+		lat[i] = now() - t;
+		t += lat[i];
+	}
+	report(size, "close", lat, (size + 1) / 2);
+
+	/* litev_close() has already closed the FDs that it was given. */
+	for (i = (size + 1) / 2; i < nfd; ++i)
+		close(fds[i]);
+	free(fds);
+	free(lat);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct rlimit	 rl;
+	const char	*backend;
+	size_t		 i, j;
+
+	/* The largest sizes require plenty of FDs. */
+	if (getrlimit(RLIMIT_NOFILE, &rl) == -1)
+		err(1, "getrlimit");
+	rl.rlim_cur = rl.rlim_max;
+	if (setrlimit(RLIMIT_NOFILE, &rl) == -1)
+		err(1, "setrlimit");
+
+	printf("backend\tsize\top\tn\tavg\tp50\tp99\tmax\n");
+	for (j = 0; (backend = litev_backend_at(j)) != NULL; ++j) {
+		for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+			/* Leave some FDs for stdio and the backend. */
+			if ((sizes[i] + 3) / 4 * 2 + 16 > rl.rlim_cur) {
+				fprintf(stderr, "churn: skipping %zu "
+				    "registrations, RLIMIT_NOFILE is too "
+				    "low\n", sizes[i]);
+				continue;
+			}
+
+			if ((base = litev_init_backend(backend)) == NULL)
+				errx(1, "litev_init_backend %s", backend);
+			churn(base, sizes[i]);
+			litev_free(&base);
+		}
+	}
+
+	return (0);
+}
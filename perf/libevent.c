@@ -47,7 +47,7 @@ accept_cb(int s, short condition, void *udata)
 	/* Add the new connection to the event loop. */
 	if ((ev = malloc(sizeof(struct event))) == NULL)
 		err(1, "malloc");
-	event_set(ev, c, EV_READ, client_cb, ev);
+	event_set(ev, c, EV_READ | EV_PERSIST, client_cb, ev);
 	if (event_add(ev, NULL) != 0)
 		err(1, "event_add accept_cb");
 }
@@ -55,9 +55,11 @@ accept_cb(int s, short condition, void *udata)
 static void
 client_cb(int c, short condition, void *ev)
 {
-	send(c, PERF_REPLY, strlen(PERF_REPLY), 0);
-	close(c);
-	free(ev);
+	if (perf_serve(c) == -1) {
+		event_del(ev);
+		close(c);
+		free(ev);
+	}
 }
 
 int
@@ -27,58 +27,34 @@
 
 #include "perf.h"
 
-static void	accept_cb(int, short, void *);
 static void	client_cb(int, short, void *);
 
 static struct litev_base	*base;
 
-static void
-accept_cb(int s, short condition, void *udata)
-{
-	struct litev_ev	ev;
-	int		c;
-
-	/* Accept the incoming connection. */
-	if ((c = accept(s, NULL, NULL)) == -1) {
-		if (errno == EAGAIN)
-			return;
-		else
-			err(1, "accept");
-	}
-
-	/* Add the new connection to the event loop. */
-	ev.fd = c;
-	ev.condition = LITEV_READ;
-	ev.cb = client_cb;
-	ev.udata = NULL;
-	if (litev_add(base, &ev) != LITEV_OK)
-		err(1, "litev_add accept_cb");
-}
-
 static void
 client_cb(int c, short condition, void *udata)
 {
-	send(c, PERF_REPLY, strlen(PERF_REPLY), 0);
-	litev_close(base, c);
+	if (perf_serve(c) == -1)
+		litev_close(base, c);
 }
 
 int
 main(int argc, char *argv[])
 {
-	struct litev_ev	ev;
-	int		s;
+	struct litev_listener_opts	opts;
+	int				s;
 
 	s = perf_socket();
 
 	if ((base = litev_init()) == NULL)
 		err(1, "litev_init");
 
-	ev.fd = s;
-	ev.condition = LITEV_READ;
-	ev.cb = accept_cb;
-	ev.udata = NULL;
-	if (litev_add(base, &ev) != LITEV_OK)
-		err(1, "litev_add");
+	opts.budget = 0;
+	opts.cb = client_cb;
+	opts.udata = NULL;
+	opts.err_cb = NULL;
+	if (litev_listener_add(base, s, NULL, &opts) != LITEV_OK)
+		err(1, "litev_listener_add");
 
 	if (litev_dispatch(base) != LITEV_OK)
 		err(1, "litev_dispatch");
@@ -0,0 +1,427 @@
+/*
+ * Copyright (c) 2022-2024 Emil Engler <me@emilengler.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * A HTTP/1.1 load generator on top of litev, so that the servers in this
+ * directory can be compared without any external tools.
+ *
+ * Every connection keeps depth requests in flight and sends a new one as
+ * soon as a response has been completed.  With -C, every request is sent
+ * on a new connection that is closed after the response.  The latency of
+ * a request is measured from queueing it until its response is complete.
+ */
+
+/* Required for clock_gettime(2) and getopt(3). */
+#define _POSIX_C_SOURCE	200809L
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "litev.h"
+
+#define MAXDEPTH	64
+#define MAXHDR		1024
+
+struct conn {
+	unsigned long long	queued[MAXDEPTH];
+	size_t			head;
+	size_t			ninflight;
+	size_t			nunsent;
+	size_t			woff;
+	size_t			hlen;
+	unsigned long long	body;
+	char			hdr[MAXHDR + 1];
+	int			fd;
+	int			is_connecting;
+	int			is_writing;
+};
+
+static void			conn_cb(int, short, void *);
+static int			conn_done(struct conn *);
+static int			conn_flush(struct conn *);
+static void			conn_open(struct conn *);
+static void			conn_queue(struct conn *);
+static void			conn_read(struct conn *);
+static void			conn_recycle(struct conn *);
+static unsigned long long	content_length(const char *);
+static unsigned long long	now(void);
+static void			sigalrm(int);
+static void			usage(void);
+
+static struct litev_base	*base;
+static struct sockaddr_in	 sa;
+static struct litev_hist	 hist;
+static char			 req[256];
+static size_t			 reqlen, depth;
+static unsigned long long	 nerr;
+static int			 is_close;
+static volatile sig_atomic_t	 is_done;
+
+static unsigned long long
+now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+static void
+sigalrm(int sig)
+{
+	is_done = 1;
+}
+
+/*
+ * Parse the Content-Length out of the NUL-terminated response header.
+ */
+static unsigned long long
+content_length(const char *hdr)
+{
+	static const char	 name[] = "\r\nContent-Length:";
+
+	for (; (hdr = strchr(hdr, '\r')) != NULL; ++hdr) {
+		if (strncasecmp(hdr, name, strlen(name)) == 0)
+			return (strtoull(hdr + strlen(name), NULL, 10));
+	}
+
+	return (0);
+}
+
+static void
+conn_open(struct conn *c)
+{
+	struct litev_ev	ev;
+
+	if ((c->fd = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+		err(1, "socket");
+	if (fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK) == -1)
+		err(1, "fcntl");
+	if (connect(c->fd, (struct sockaddr *)&sa, sizeof(sa)) == -1 &&
+	    errno != EINPROGRESS)
+		err(1, "connect");
+
+	c->head = 0;
+	c->ninflight = 0;
+	c->nunsent = 0;
+	c->woff = 0;
+	c->hlen = 0;
+	c->body = 0;
+	c->is_connecting = 1;
+
+	/* The connection has been established once it is writable. */
+	ev.fd = c->fd;
+	ev.condition = LITEV_WRITE;
+	ev.cb = conn_cb;
+	ev.udata = c;
+	if (litev_add(base, &ev) != LITEV_OK)
+		errx(1, "litev_add");
+	c->is_writing = 1;
+}
+
+/*
+ * Replace the connection by a new one.
+ */
+static void
+conn_recycle(struct conn *c)
+{
+	litev_close(base, c->fd);
+	conn_open(c);
+}
+
+static void
+conn_queue(struct conn *c)
+{
+	c->queued[(c->head + c->ninflight) % MAXDEPTH] = now();
+	++c->ninflight;
+	++c->nunsent;
+}
+
+/*
+ * Send all queued requests, waiting for the socket to become writable if
+ * they do not fit.  Returns -1 if the connection has been replaced.
+ */
+static int
+conn_flush(struct conn *c)
+{
+	struct litev_ev	ev;
+	ssize_t		n;
+
+	while (c->nunsent > 0) {
+		n = send(c->fd, req + c->woff, reqlen - c->woff, 0);
+		if (n == -1)
+			break;
+		if ((c->woff += n) == reqlen) {
+			c->woff = 0;
+			--c->nunsent;
+		}
+	}
+	if (c->nunsent > 0 && errno != EAGAIN) {
+		++nerr;
+		conn_recycle(c);
+		return (-1);
+	}
+
+	ev.fd = c->fd;
+	ev.condition = LITEV_WRITE;
+	ev.cb = conn_cb;
+	ev.udata = c;
+	if (c->nunsent > 0 && !c->is_writing) {
+		if (litev_add(base, &ev) != LITEV_OK)
+			errx(1, "litev_add");
+		c->is_writing = 1;
+	} else if (c->nunsent == 0 && c->is_writing) {
+		if (litev_del(base, &ev) != LITEV_OK)
+			errx(1, "litev_del");
+		c->is_writing = 0;
+	}
+
+	return (0);
+}
+
+/*
+ * Account for a completed response.  Returns -1 if the connection has been
+ * replaced.
+ */
+static int
+conn_done(struct conn *c)
+{
+	litev_hist_record(&hist, now() - c->queued[c->head]);
+	c->head = (c->head + 1) % MAXDEPTH;
+	--c->ninflight;
+
+	if (is_close) {
+		conn_recycle(c);
+		return (-1);
+	}
+
+	conn_queue(c);
+
+	return (conn_flush(c));
+}
+
+static void
+conn_read(struct conn *c)
+{
+	char		buf[16384];
+	ssize_t		n, i;
+	size_t		k;
+
+	if ((n = recv(c->fd, buf, sizeof(buf), 0)) == -1) {
+		if (errno == EAGAIN)
+			return;
+		++nerr;
+		conn_recycle(c);
+		return;
+	}
+	if (n == 0) {
+		/* The server hung up with responses outstanding. */
+		++nerr;
+		conn_recycle(c);
+		return;
+	}
+
+	for (i = 0; i < n; ) {
+		if (c->body > 0) {
+			k = n - i;
+			if (k > c->body)
+				k = c->body;
+			c->body -= k;
+			i += k;
+			if (c->body == 0 && conn_done(c) == -1)
+				return;
+			continue;
+		}
+
+		if (c->hlen == MAXHDR)
+			errx(1, "response header too large");
+		c->hdr[c->hlen++] = buf[i++];
+		if (c->hlen < 4 || memcmp(&c->hdr[c->hlen - 4], "\r\n\r\n", 4))
+			continue;
+
+		c->hdr[c->hlen] = '\0';
+		c->body = content_length(c->hdr);
+		c->hlen = 0;
+		if (c->body == 0 && conn_done(c) == -1)
+			return;
+	}
+}
+
+static void
+conn_cb(int fd, short condition, void *udata)
+{
+	struct litev_ev	 ev;
+	struct conn	*c;
+	socklen_t	 len;
+	size_t		 i;
+	int		 error;
+
+	c = udata;
+
+	if (is_done) {
+		litev_break(base);
+		return;
+	}
+
+	if (condition == LITEV_READ) {
+		conn_read(c);
+		return;
+	}
+
+	if (c->is_connecting) {
+		len = sizeof(error);
+		if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) == -1)
+			err(1, "getsockopt");
+		if (error != 0) {
+			errno = error;
+			err(1, "connect");
+		}
+		c->is_connecting = 0;
+
+		ev.fd = fd;
+		ev.condition = LITEV_READ;
+		ev.cb = conn_cb;
+		ev.udata = c;
+		if (litev_add(base, &ev) != LITEV_OK)
+			errx(1, "litev_add");
+
+		for (i = 0; i < depth; ++i)
+			conn_queue(c);
+	}
+
+	conn_flush(c);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: loadgen [-C] [-a address] [-c connections] "
+	    "[-d seconds] [-p depth]\n\t[-P port]\n");
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sigaction	 act;
+	struct conn		*conns;
+	unsigned long long	 start, elapsed;
+	const char		*addr;
+	size_t			 nconn, i;
+	int			 ch, duration, port;
+
+	addr = "127.0.0.1";
+	nconn = 64;
+	duration = 10;
+	depth = 1;
+	port = 8080;
+
+	while ((ch = getopt(argc, argv, "Ca:c:d:p:P:")) != -1) {
+		switch (ch) {
+		case 'C':
+			is_close = 1;
+			break;
+		case 'a':
+			addr = optarg;
+			break;
+		case 'c':
+			nconn = strtoul(optarg, NULL, 10);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 'p':
+			depth = strtoul(optarg, NULL, 10);
+			break;
+		case 'P':
+			port = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (nconn == 0 || duration <= 0 || depth == 0 || depth > MAXDEPTH ||
+	    port <= 0 || port > 65535)
+		usage();
+
+	/* Every connection only carries a single request in close mode. */
+	if (is_close)
+		depth = 1;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(port);
+	if (inet_pton(AF_INET, addr, &sa.sin_addr) != 1)
+		errx(1, "invalid address: %s", addr);
+
+	reqlen = snprintf(req, sizeof(req), "GET / HTTP/1.1\r\nHost: %s\r\n%s"
+	    "\r\n", addr, is_close ? "Connection: close\r\n" : "");
+
+	/* Writing to a connection that has been reset must not kill us. */
+	signal(SIGPIPE, SIG_IGN);
+
+	memset(&act, 0, sizeof(act));
+	act.sa_handler = sigalrm;
+	if (sigaction(SIGALRM, &act, NULL) == -1)
+		err(1, "sigaction");
+
+	if ((base = litev_init()) == NULL)
+		errx(1, "litev_init");
+	if ((conns = calloc(nconn, sizeof(struct conn))) == NULL)
+		err(1, "calloc");
+	for (i = 0; i < nconn; ++i)
+		conn_open(&conns[i]);
+
+	start = now();
+	alarm(duration);
+	if (litev_dispatch(base) != LITEV_OK)
+		errx(1, "litev_dispatch");
+	elapsed = now() - start;
+
+	printf("connections\t%zu\n", nconn);
+	printf("depth\t\t%zu\n", depth);
+	printf("mode\t\t%s\n", is_close ? "close" : "keep-alive");
+	printf("requests\t%llu\n", hist.count);
+	printf("errors\t\t%llu\n", nerr);
+	printf("duration\t%.3f s\n", elapsed / 1e9);
+	printf("throughput\t%.1f req/s\n", hist.count / (elapsed / 1e9));
+	printf("p50\t\t%.1f us\n", litev_hist_quantile(&hist, 0.5) / 1e3);
+	printf("p99\t\t%.1f us\n", litev_hist_quantile(&hist, 0.99) / 1e3);
+	printf("p999\t\t%.1f us\n", litev_hist_quantile(&hist, 0.999) / 1e3);
+	printf("max\t\t%.1f us\n", hist.max / 1e3);
+
+	for (i = 0; i < nconn; ++i)
+		close(conns[i].fd);
+	free(conns);
+	litev_free(&base);
+
+	return (0);
+}
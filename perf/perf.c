@@ -20,6 +20,7 @@
 #include <netinet/in.h>
 
 #include <err.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <string.h>
 
@@ -27,6 +28,47 @@
 
 static const int	true = 1;
 
+/* The amount of bytes of "\r\n\r\n" that have been seen on each FD. */
+static unsigned char	matched[PERF_MAXFD];
+
+/*
+ * Read from the connection c and reply to every request that has been
+ * completed, so that keep-alive and pipelining work.  Requests are assumed
+ * to not have a body.  Returns -1 if the connection shall be closed.
+ */
+int
+perf_serve(int c)
+{
+	static const char	 term[] = "\r\n\r\n";
+	char			 buf[4096];
+	ssize_t			 n, i;
+
+	if (c >= PERF_MAXFD)
+		return (-1);
+
+	if ((n = recv(c, buf, sizeof(buf), 0)) <= 0) {
+		matched[c] = 0;
+		return (n == -1 && errno == EAGAIN ? 0 : -1);
+	}
+
+	for (i = 0; i < n; ++i) {
+		if (buf[i] != term[matched[c]]) {
+			matched[c] = buf[i] == '\r';
+			continue;
+		}
+		if (++matched[c] < strlen(term))
+			continue;
+
+		matched[c] = 0;
+		if (send(c, PERF_REPLY, strlen(PERF_REPLY), 0) == -1) {
+			matched[c] = 0;
+			return (-1);
+		}
+	}
+
+	return (0);
+}
+
 int
 perf_socket(void)
 {
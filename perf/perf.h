@@ -22,6 +22,10 @@
 			"\r\n"				\
 			"Hello, world!"
 
+/* The largest FD that perf_serve() can keep track of. */
+#define PERF_MAXFD	65536
+
+int			perf_serve(int);
 int			perf_socket(void);
 
 #endif
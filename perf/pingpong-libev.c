@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2022-2024 Emil Engler <me@emilengler.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <ev.h>
+
+#include "pingpong.h"
+
+static void	read_cb(struct ev_loop *, ev_io *, int);
+
+const char	*pp_lib_name = "libev";
+
+static struct ev_loop	*loop;
+static ev_io		*ws;
+
+static void
+read_cb(struct ev_loop *loop, ev_io *w, int revents)
+{
+	if (pp_read(w->fd, (uintptr_t)w->data))
+		ev_break(loop, EVBREAK_ALL);
+}
+
+void
+pp_lib_init(size_t npipe)
+{
+	if ((loop = ev_loop_new(EVFLAG_AUTO)) == NULL)
+		errx(1, "ev_loop_new");
+	if ((ws = calloc(npipe, sizeof(ev_io))) == NULL)
+		err(1, "calloc");
+}
+
+void
+pp_lib_add(size_t idx, int fd)
+{
+	/* Stopping a watcher that has never been started is a no-op. */
+	ev_io_stop(loop, &ws[idx]);
+	ev_io_init(&ws[idx], read_cb, fd, EV_READ);
+	ws[idx].data = (void *)(uintptr_t)idx;
+	ev_io_start(loop, &ws[idx]);
+}
+
+void
+pp_lib_run(void)
+{
+	ev_run(loop, 0);
+}
+
+void
+pp_lib_free(void)
+{
+	ev_loop_destroy(loop);
+	free(ws);
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2022-2024 Emil Engler <me@emilengler.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <event.h>
+
+#include "pingpong.h"
+
+static void	read_cb(int, short, void *);
+
+const char	*pp_lib_name = "libevent";
+
+static struct event_base	*base;
+static struct event		*evs;
+static int			*added;
+
+static void
+read_cb(int fd, short condition, void *udata)
+{
+	if (pp_read(fd, (uintptr_t)udata))
+		event_base_loopbreak(base);
+}
+
+void
+pp_lib_init(size_t npipe)
+{
+	if ((base = event_base_new()) == NULL)
+		errx(1, "event_base_new");
+	if ((evs = calloc(npipe, sizeof(struct event))) == NULL ||
+	    (added = calloc(npipe, sizeof(int))) == NULL)
+		err(1, "calloc");
+}
+
+void
+pp_lib_add(size_t idx, int fd)
+{
+	if (added[idx])
+		event_del(&evs[idx]);
+	event_set(&evs[idx], fd, EV_READ | EV_PERSIST, read_cb,
+	    (void *)(uintptr_t)idx);
+	event_base_set(base, &evs[idx]);
+	if (event_add(&evs[idx], NULL) != 0)
+		errx(1, "event_add");
+	added[idx] = 1;
+}
+
+void
+pp_lib_run(void)
+{
+	if (event_base_dispatch(base) == -1)
+		errx(1, "event_base_dispatch");
+}
+
+void
+pp_lib_free(void)
+{
+	event_base_free(base);
+	free(evs);
+	free(added);
+}
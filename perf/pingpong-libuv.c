@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2022-2024 Emil Engler <me@emilengler.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <uv.h>
+
+#include "pingpong.h"
+
+static void	read_cb(uv_poll_t *, int, int);
+
+const char	*pp_lib_name = "libuv";
+
+static uv_loop_t	 loop;
+static uv_poll_t	*hs;
+static size_t		 nh;
+
+static void
+read_cb(uv_poll_t *h, int status, int events)
+{
+	uv_os_fd_t	fd;
+
+	if (uv_fileno((uv_handle_t *)h, &fd) != 0)
+		errx(1, "uv_fileno");
+	if (pp_read(fd, (uintptr_t)h->data))
+		uv_stop(&loop);
+}
+
+void
+pp_lib_init(size_t npipe)
+{
+	if (uv_loop_init(&loop) != 0)
+		errx(1, "uv_loop_init");
+	if ((hs = calloc(npipe, sizeof(uv_poll_t))) == NULL)
+		err(1, "calloc");
+	nh = 0;
+}
+
+void
+pp_lib_add(size_t idx, int fd)
+{
+	/* The handles are created once and only restarted afterwards. */
+	if (idx == nh) {
+		if (uv_poll_init(&loop, &hs[idx], fd) != 0)
+			errx(1, "uv_poll_init");
+		hs[idx].data = (void *)(uintptr_t)idx;
+		++nh;
+	} else {
+		uv_poll_stop(&hs[idx]);
+	}
+	if (uv_poll_start(&hs[idx], UV_READABLE, read_cb) != 0)
+		errx(1, "uv_poll_start");
+}
+
+void
+pp_lib_run(void)
+{
+	uv_run(&loop, UV_RUN_DEFAULT);
+}
+
+void
+pp_lib_free(void)
+{
+	size_t	i;
+
+	for (i = 0; i < nh; ++i)
+		uv_close((uv_handle_t *)&hs[i], NULL);
+	uv_run(&loop, UV_RUN_DEFAULT);
+	if (uv_loop_close(&loop) != 0)
+		errx(1, "uv_loop_close");
+	free(hs);
+}
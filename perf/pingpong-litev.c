@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2022-2024 Emil Engler <me@emilengler.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <litev.h>
+
+#include "pingpong.h"
+
+static void	read_cb(int, short, void *);
+
+const char	*pp_lib_name = "litev";
+
+static struct litev_base	*base;
+static int			*added;
+
+static void
+read_cb(int fd, short condition, void *udata)
+{
+	if (pp_read(fd, (uintptr_t)udata))
+		litev_break(base);
+}
+
+void
+pp_lib_init(size_t npipe)
+{
+	if ((base = litev_init()) == NULL)
+		errx(1, "litev_init");
+	if ((added = calloc(npipe, sizeof(int))) == NULL)
+		err(1, "calloc");
+}
+
+void
+pp_lib_add(size_t idx, int fd)
+{
+	struct litev_ev	ev;
+
+	ev.fd = fd;
+	ev.condition = LITEV_READ;
+	ev.cb = read_cb;
+	ev.udata = (void *)(uintptr_t)idx;
+
+	if (added[idx] && litev_del(base, &ev) != LITEV_OK)
+		errx(1, "litev_del");
+	if (litev_add(base, &ev) != LITEV_OK)
+		errx(1, "litev_add");
+	added[idx] = 1;
+}
+
+void
+pp_lib_run(void)
+{
+	if (litev_dispatch(base) != LITEV_OK)
+		errx(1, "litev_dispatch");
+}
+
+void
+pp_lib_free(void)
+{
+	litev_free(&base);
+	free(added);
+}
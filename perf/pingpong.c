@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2022-2024 Emil Engler <me@emilengler.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * A ping-pong benchmark in the style of bench.c of libevent: out of npipe
+ * socketpairs, nactive ones are written to at the beginning of a run.
+ * Every read triggers a write to the next socketpair, until nwrite writes
+ * have happened and every byte has been read.
+ *
+ * The time to register all npipe sockets and the time to run the loop are
+ * printed separately as tab-separated values, so that the costs per
+ * registered and per ready event can be told apart.
+ */
+
+/* Required for clock_gettime(2). */
+#define _POSIX_C_SOURCE	200809L
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pingpong.h"
+
+#define NRUN	10
+#define NWRITE	10000
+
+static unsigned long long	now(void);
+static void			run(size_t, size_t);
+
+static const size_t	npipes[] = { 100, 1000, 10000, 100000 };
+static const size_t	nactives[] = { 1, 10, 100, 1000 };
+
+static int	*fds;
+static size_t	 npipe, count, fired, writes;
+
+static unsigned long long
+now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+/*
+ * Read from pipe idx and pass the ball on to the next one.  Returns 1 once
+ * the run is over.
+ */
+int
+pp_read(int fd, size_t idx)
+{
+	size_t	widx;
+	char	ch;
+
+	if (read(fd, &ch, 1) == 1)
+		++count;
+
+	if (writes > 0) {
+		widx = (idx + 1) % npipe;
+		if (write(fds[widx * 2 + 1], "e", 1) != 1)
+			err(1, "write");
+		--writes;
+		++fired;
+	}
+
+	return (count == fired);
+}
+
+static void
+run(size_t n, size_t nactive)
+{
+	unsigned long long	t, setup, loop;
+	size_t			i, r, space;
+
+	npipe = n;
+	if ((fds = calloc(npipe * 2, sizeof(int))) == NULL)
+		err(1, "calloc");
+	for (i = 0; i < npipe; ++i) {
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, &fds[i * 2]) == -1)
+			err(1, "socketpair");
+	}
+	pp_lib_init(npipe);
+
+	setup = loop = 0;
+	for (r = 0; r < NRUN; ++r) {
+		t = now();
+		for (i = 0; i < npipe; ++i)
+			pp_lib_add(i, fds[i * 2]);
+		setup += now() - t;
+
+		/* Spread the active pipes evenly. */
+		space = npipe / nactive;
+		for (i = 0, fired = 0; i < nactive; ++i, ++fired) {
+			if (write(fds[i * space * 2 + 1], "e", 1) != 1)
+				err(1, "write");
+		}
+		count = 0;
+		writes = NWRITE;
+
+		t = now();
+		pp_lib_run();
+		loop += now() - t;
+	}
+
+	printf("%s\t%zu\t%zu\t%.1f\t%.1f\t%.1f\n", pp_lib_name, npipe,
+	    nactive, setup / 1e3 / NRUN, loop / 1e3 / NRUN,
+	    (double)loop / NRUN / (NWRITE + nactive));
+
+	pp_lib_free();
+	for (i = 0; i < npipe * 2; ++i)
+		close(fds[i]);
+	free(fds);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct rlimit	rl;
+	size_t		i, j;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) == -1)
+		err(1, "getrlimit");
+	rl.rlim_cur = rl.rlim_max;
+	if (setrlimit(RLIMIT_NOFILE, &rl) == -1)
+		err(1, "setrlimit");
+
+	printf("lib\tnpipe\tnactive\tsetup_us\tloop_us\tns_per_event\n");
+	for (i = 0; i < sizeof(npipes) / sizeof(npipes[0]); ++i) {
+		if (npipes[i] * 2 + 16 > rl.rlim_cur) {
+			fprintf(stderr, "pingpong: skipping %zu pipes, "
+			    "RLIMIT_NOFILE is too low\n", npipes[i]);
+			continue;
+		}
+
+		for (j = 0; j < sizeof(nactives) / sizeof(nactives[0]); ++j) {
+			if (nactives[j] <= npipes[i])
+				run(npipes[i], nactives[j]);
+		}
+	}
+
+	return (0);
+}
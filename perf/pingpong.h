@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) 2022-2024 Emil Engler <me@emilengler.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef PINGPONG_H
+#define PINGPONG_H
+
+/*
+ * Implemented by every library in pingpong-*.c.  pp_lib_add() registers
+ * the reading end of pipe idx, removing a previous registration of it
+ * first, and pp_lib_run() dispatches until pp_read() returns 1.
+ */
+extern const char	*pp_lib_name;
+
+void	pp_lib_init(size_t);
+void	pp_lib_add(size_t, int);
+void	pp_lib_run(void);
+void	pp_lib_free(void);
+
+int	pp_read(int, size_t);
+
+#endif
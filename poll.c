@@ -31,36 +31,39 @@
 #include "litev.h"
 #include "litev-internal.h"
 #include "ev_api.h"
+#include "hash.h"
+#include "mem.h"
 
 #define GROW	128
 
 /*
- * pfd_ev shares the indices with pfd, so the look-ups for the appropriate
- * callbacks with their udata are O(1).
- *
- * TODO: Add a hash table, so that removals are O(1).
+ * pfd_node shares the indices with pfd, so the look-ups for the appropriate
+ * callbacks with their udata are O(1).  In turn, the idx of every enabled
+ * node is its index inside pfd, so that removals are O(1) as well.
  */
 struct poll_data {
-	struct pollfd	*pfd;
-	struct litev_ev	*pfd_ev;
-	size_t		 npfd;
+	struct litev_base	 *base;
+	struct pollfd		 *pfd;
+	struct litev_ev		**pfd_node;
+	size_t			  npfd;
 
 	/*
 	 * This member fields serves the only purpose to know if events have
 	 * been registered yet.  Its value is meaningless except if zero.
 	 */
-	size_t		 nactive_ev;
+	size_t			  nactive_ev;
 };
 
 static short		 condition2event(short);
 
-static size_t		 poll_find_ev(struct poll_data *, struct litev_ev *);
 static size_t		 poll_find_free(struct poll_data *);
 static int		 poll_grow(struct poll_data *);
 
-static EV_API_DATA	*poll_init(void);
+static EV_API_DATA	*poll_init(struct litev_base *);
 static void		 poll_free(EV_API_DATA *);
-static int		 poll_poll(EV_API_DATA *);
+static int		 poll_poll(EV_API_DATA *, const struct timespec *);
+static int		 poll_reinit(EV_API_DATA *);
+static int		 poll_fd(EV_API_DATA *);
 static int		 poll_add(EV_API_DATA *, struct litev_ev *);
 static int		 poll_del(EV_API_DATA *, struct litev_ev *);
 static int		 poll_close(EV_API_DATA *, int);
@@ -76,30 +79,15 @@ condition2event(short condition)
 		return (POLLIN);
 	case LITEV_WRITE:
 		return (POLLOUT);
+	case LITEV_ERRQUEUE:
+		/* POLLERR is always reported and cannot be requested. */
+		return (0);
 	}
 
 	assert(0);
 	return (0);
 }
 
-/*
- * Return the index of the first occurrence of ev inside pfd or npfd in case
- * that the event does not exist within pfd.
- */
-static size_t
-poll_find_ev(struct poll_data *data, struct litev_ev *ev)
-{
-	size_t	i;
-
-	for (i = 0; i < data->npfd; ++i) {
-		if (data->pfd_ev[i].fd == ev->fd &&
-		    data->pfd_ev[i].condition == ev->condition)
-			break;
-	}
-
-	return (i);
-}
-
 /*
  * Return the index of the first free slot inside pfd or npfd in case that pfd
  * is full.
@@ -118,14 +106,14 @@ poll_find_free(struct poll_data *data)
 }
 
 /*
- * Grow pfd and pfd_ev by GROW and initialize the new slots.
+ * Grow pfd and pfd_node by GROW and initialize the new slots.
  */
 static int
 poll_grow(struct poll_data *data)
 {
-	struct pollfd	*n_pfd;
-	struct litev_ev	*n_pfd_ev;
-	size_t		 n_npfd, i;
+	struct pollfd	 *n_pfd;
+	struct litev_ev	**n_pfd_node;
+	size_t		  n_npfd, i;
 
 	/* Check for integer overflows. */
 	if (SIZE_MAX - GROW < data->npfd)
@@ -133,44 +121,50 @@ poll_grow(struct poll_data *data)
 	n_npfd = data->npfd + GROW;
 	if (n_npfd > SIZE_MAX / sizeof(struct pollfd))
 		return (LITEV_EOVERFLOW);
-	if (n_npfd > SIZE_MAX / sizeof(struct litev_ev))
+	if (n_npfd > SIZE_MAX / sizeof(struct litev_ev *))
 		return (LITEV_EOVERFLOW);
 
 	/* Allocate the new space. */
-	n_pfd = realloc(data->pfd, sizeof(struct pollfd) * n_npfd);
+	n_pfd = mem_reallocarray(data->base, data->pfd, n_npfd,
+	    sizeof(struct pollfd));
 	if (n_pfd == NULL)
 		return (-1);
 	data->pfd = n_pfd;
 
-	n_pfd_ev = realloc(data->pfd_ev, sizeof(struct litev_ev) * n_npfd);
-	if (n_pfd_ev == NULL)
+	n_pfd_node = mem_reallocarray(data->base, data->pfd_node, n_npfd,
+	    sizeof(struct litev_ev *));
+	if (n_pfd_node == NULL)
 		return (-1);
-	data->pfd_ev = n_pfd_ev;
+	data->pfd_node = n_pfd_node;
 
 	/* Initialize the new slots. */
 	for (i = data->npfd; i < n_npfd; ++i) {
 		data->pfd[i].fd = -1;
 		data->pfd[i].events = 0;
 		data->pfd[i].revents = 0;
-		data->pfd_ev[i].fd = -1;
-		data->pfd_ev[i].condition = 0;
+		data->pfd_node[i] = NULL;
 	}
 
 	data->npfd = n_npfd;
 
+	++data->base->stats.ngrow;
+	data->base->stats.nbytes_ev += (sizeof(struct pollfd) +
+	    sizeof(struct litev_ev *)) * GROW;
+
 	return (LITEV_OK);
 }
 
 static EV_API_DATA *
-poll_init(void)
+poll_init(struct litev_base *base)
 {
 	struct poll_data	*data;
 
-	if ((data = malloc(sizeof(struct poll_data))) == NULL)
+	if ((data = mem_malloc(base, sizeof(struct poll_data))) == NULL)
 		return (NULL);
 
+	data->base = base;
 	data->pfd = NULL;
-	data->pfd_ev = NULL;
+	data->pfd_node = NULL;
 	data->npfd = 0;
 	data->nactive_ev = 0;
 
@@ -184,43 +178,68 @@ poll_free(EV_API_DATA *raw_data)
 
 	data = raw_data;
 
-	free(data->pfd);
-	free(data->pfd_ev);
+	mem_free(data->base, data->pfd);
+	mem_free(data->base, data->pfd_node);
+	data->base->stats.nbytes_ev -= (sizeof(struct pollfd) +
+	    sizeof(struct litev_ev *)) * data->npfd;
 
-	free(data);
+	mem_free(data->base, data);
 }
 
 static int
-poll_poll(EV_API_DATA *raw_data)
+poll_poll(EV_API_DATA *raw_data, const struct timespec *timeout)
 {
 	struct poll_data	*data;
+	struct litev_ev		*node;
 	size_t			 i;
+	int			 nready;
 	short			 revent;
 
 	data = raw_data;
 
-	/* Return immediately, if no events have been registered yet. */
-	if (data->nactive_ev == 0)
+	/*
+	 * Return immediately, if no events have been registered yet, unless
+	 * the caller wants to wait until timeout anyway.
+	 */
+	if (data->nactive_ev == 0 && timeout == NULL)
 		return (LITEV_OK);
 
-	if (poll(data->pfd, data->npfd, -1) == -1 && errno != EINTR)
+	ev_wait(data->base);
+	nready = poll(data->pfd, data->npfd, ev_timeout_ms(timeout));
+	if (nready == -1 && errno != EINTR)
 		return (-1);
+	ev_ready(data->base, nready);
 
 	for (i = 0; i < data->npfd; ++i) {
-		/* Just to not exceed 79 characters in the if statement. :^) */
+		/* Slots that have been freed by a callback have no revents. */
 		revent = data->pfd[i].revents;
-		if (revent == POLLIN || revent == POLLOUT) {
-			data->pfd_ev[i].cb(data->pfd_ev[i].fd,
-					   data->pfd_ev[i].condition,
-					   data->pfd_ev[i].udata);
-		}
+		node = data->pfd_node[i];
+		if (revent == POLLIN || revent == POLLOUT ||
+		    (revent & POLLERR && node->condition == LITEV_ERRQUEUE))
+			ev_cb(data->base, node);
 	}
 
 	return (LITEV_OK);
 }
 
+/*
+ * poll(2) has no kernel object, the pollfd array is private to the process
+ * already.
+ */
+static int
+poll_reinit(EV_API_DATA *raw_data)
+{
+	return (LITEV_OK);
+}
+
 static int
-poll_add(EV_API_DATA *raw_data, struct litev_ev *ev)
+poll_fd(EV_API_DATA *raw_data)
+{
+	return (-1);
+}
+
+static int
+poll_add(EV_API_DATA *raw_data, struct litev_ev *node)
 {
 	struct poll_data	*data;
 	size_t			 slot;
@@ -228,20 +247,17 @@ poll_add(EV_API_DATA *raw_data, struct litev_ev *ev)
 
 	data = raw_data;
 
-	/* Check if the event is already registered. */
-	if (poll_find_ev(data, ev) != data->npfd)
-		return (LITEV_EEXIST);
-
 	/* Check if we need to allocate more space for events. */
 	if ((slot = poll_find_free(data)) == data->npfd) {
 		if ((rc = poll_grow(data)) != LITEV_OK)
 			return (rc);
 	}
 
-	data->pfd[slot].fd = ev->fd;
-	data->pfd[slot].events = condition2event(ev->condition);
+	data->pfd[slot].fd = node->fd;
+	data->pfd[slot].events = condition2event(node->condition);
 	data->pfd[slot].revents = 0;
-	memcpy(&data->pfd_ev[slot], ev, sizeof(struct litev_ev));
+	data->pfd_node[slot] = node;
+	node->link.idx = slot;
 
 	++data->nactive_ev;
 
@@ -249,23 +265,19 @@ poll_add(EV_API_DATA *raw_data, struct litev_ev *ev)
 }
 
 static int
-poll_del(EV_API_DATA *raw_data, struct litev_ev *ev)
+poll_del(EV_API_DATA *raw_data, struct litev_ev *node)
 {
 	struct poll_data	*data;
 	size_t			 slot;
 
 	data = raw_data;
-
-	/* Check if the event is even registered. */
-	if ((slot = poll_find_ev(data, ev)) == data->npfd)
-		return (LITEV_ENOENT);
+	slot = node->link.idx;
 
 	/* Remove the event from poll(2). */
 	data->pfd[slot].fd = -1;
 	data->pfd[slot].events = 0;
 	data->pfd[slot].revents = 0;
-	data->pfd_ev[slot].fd = -1;
-	data->pfd_ev[slot].condition = 0;
+	data->pfd_node[slot] = NULL;
 
 	--data->nactive_ev;
 
@@ -276,16 +288,23 @@ static int
 poll_close(EV_API_DATA *raw_data, int fd)
 {
 	struct poll_data	*data;
+	struct litev_ev		*node;
 	struct litev_ev		 ev;
+	short			 conditions[] = {
+		LITEV_READ, LITEV_WRITE, LITEV_ERRQUEUE
+	};
+	size_t			 i;
 
 	data = raw_data;
 	ev.fd = fd;
 
-	/* Remove all possible events that could contain fd. */
-	ev.condition = LITEV_READ;
-	poll_del(data, &ev);
-	ev.condition = LITEV_WRITE;
-	poll_del(data, &ev);
+	/* Free the slots of all enabled events of fd. */
+	for (i = 0; i < sizeof(conditions) / sizeof(conditions[0]); ++i) {
+		ev.condition = conditions[i];
+		node = hash_lookup(data->base->hash, &ev);
+		if (node != NULL && node->link.is_enabled)
+			poll_del(data, node);
+	}
 
 	return (close(fd) == 0 ? LITEV_OK : -1);
 }
@@ -293,9 +312,12 @@ poll_close(EV_API_DATA *raw_data, int fd)
 void
 ev_api_poll(struct litev_ev_api *ev_api)
 {
+	ev_api->name = "poll";
 	ev_api->init = poll_init;
 	ev_api->free = poll_free;
 	ev_api->poll = poll_poll;
+	ev_api->reinit = poll_reinit;
+	ev_api->fd = poll_fd;
 	ev_api->add = poll_add;
 	ev_api->del = poll_del;
 	ev_api->close = poll_close;
@@ -0,0 +1,399 @@
+/*
+ * Copyright (c) 2022-2024 Emil Engler <me@emilengler.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#include "litev.h"
+#include "litev-internal.h"
+#include "hash.h"
+#include "mem.h"
+#include "ratelimit.h"
+#include "timer.h"
+
+#define GROW	16
+
+/*
+ * A suspended bucket is resumed once it holds half of its burst again, so
+ * that a throttled group wakes up once per half burst rather than once per
+ * token.
+ */
+#define RESUME(b)	((b)->burst / 2)
+
+static struct rl_bucket	*rl_bucket(struct litev_rl *, short);
+static void		 rl_fill(struct rl_bucket *, unsigned long long);
+static int		 rl_arm(struct rl_bucket *);
+static void		 rl_wakeup(void *);
+static void		 rl_suspend(struct litev_base *, int, short);
+static void		 rl_resume(struct litev_base *, int, short);
+static void		 rl_unlink(struct litev_rl *);
+
+static struct rl_bucket *
+rl_bucket(struct litev_rl *rl, short condition)
+{
+	switch (condition) {
+	case LITEV_READ:
+		return (&rl->bucket[0]);
+	case LITEV_WRITE:
+		return (&rl->bucket[1]);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Add the tokens that have accumulated since the last refill.
+ */
+static void
+rl_fill(struct rl_bucket *b, unsigned long long now)
+{
+	if (now <= b->last)
+		return;
+
+	b->tokens += (double)(now - b->last) * b->rate / 1e9;
+	if (b->tokens > b->burst)
+		b->tokens = b->burst;
+	b->last = now;
+}
+
+/*
+ * Arm the timer of b for the time at which it can be resumed.
+ */
+static int
+rl_arm(struct rl_bucket *b)
+{
+	unsigned long long	wait;
+	double			need;
+
+	/* Round up, so that the bucket is ready once the timer fires. */
+	need = RESUME(b) - b->tokens;
+	wait = need > 0 ? (unsigned long long)(need * 1e9 / b->rate) + 1 : 0;
+
+	return (timer_add(b->rl->base, &b->timer, wait));
+}
+
+/*
+ * Resume the suspended bucket b, if it has been refilled far enough, or
+ * wait for the rest.  If the timer cannot be armed again, b is resumed
+ * early rather than never.
+ */
+static void
+rl_wakeup(void *udata)
+{
+	struct rl_bucket	*b;
+	size_t			 i;
+
+	b = udata;
+
+	rl_fill(b, timer_now());
+	if (b->tokens < RESUME(b) && rl_arm(b) == LITEV_OK)
+		return;
+
+	b->is_suspended = 0;
+	for (i = 0; i < b->rl->nfd; ++i)
+		rl_resume(b->rl->base, b->rl->fds[i], b->condition);
+}
+
+/*
+ * Take the event of condition on fd out of the kernel, if it is enabled.
+ */
+static void
+rl_suspend(struct litev_base *base, int fd, short condition)
+{
+	struct litev_ev	*node;
+	struct litev_ev	 ev;
+
+	ev.fd = fd;
+	ev.condition = condition;
+	node = hash_lookup(base->hash, &ev);
+	if (node == NULL || !node->link.is_enabled)
+		return;
+
+	if (base->ev_api.del(base->ev_api_data, node) == LITEV_OK) {
+		node->link.is_enabled = 0;
+		node->link.is_throttled = 1;
+	}
+}
+
+/*
+ * Give the event of condition on fd back to the kernel, if it has been
+ * suspended and no other group of fd still holds it back.
+ */
+static void
+rl_resume(struct litev_base *base, int fd, short condition)
+{
+	struct litev_ev	*node;
+	struct litev_ev	 ev;
+
+	ev.fd = fd;
+	ev.condition = condition;
+	node = hash_lookup(base->hash, &ev);
+	if (node == NULL || !node->link.is_throttled)
+		return;
+	if (rl_is_suspended(base, fd, condition))
+		return;
+
+	node->link.is_throttled = 0;
+	if (base->ev_api.add(base->ev_api_data, node) == LITEV_OK)
+		node->link.is_enabled = 1;
+}
+
+static void
+rl_unlink(struct litev_rl *rl)
+{
+	struct litev_rl	**rlp;
+
+	for (rlp = &rl->base->rls; *rlp != rl; rlp = &(*rlp)->next)
+		;
+	*rlp = rl->next;
+}
+
+/*
+ * Check if a group of fd has suspended its events of condition.
+ */
+int
+rl_is_suspended(struct litev_base *base, int fd, short condition)
+{
+	struct litev_rl		*rl;
+	struct rl_bucket	*b;
+	size_t			 i;
+
+	for (rl = base->rls; rl != NULL; rl = rl->next) {
+		if ((b = rl_bucket(rl, condition)) == NULL || !b->is_suspended)
+			continue;
+		for (i = 0; i < rl->nfd; ++i) {
+			if (rl->fds[i] == fd)
+				return (1);
+		}
+	}
+
+	return (0);
+}
+
+/*
+ * Forget about fd in all groups, as it is about to be closed.
+ */
+void
+rl_close(struct litev_base *base, int fd)
+{
+	struct litev_rl	*rl;
+	size_t		 i;
+
+	for (rl = base->rls; rl != NULL; rl = rl->next) {
+		for (i = 0; i < rl->nfd; ++i) {
+			if (rl->fds[i] == fd) {
+				rl->fds[i] = rl->fds[--rl->nfd];
+				break;
+			}
+		}
+	}
+}
+
+void
+rl_free(struct litev_base *base)
+{
+	struct litev_rl	*rl;
+	int		 i;
+
+	while ((rl = base->rls) != NULL) {
+		base->rls = rl->next;
+		for (i = 0; i < 2; ++i)
+			litev_timer_del(base, &rl->bucket[i].timer);
+		mem_free(base, rl->fds);
+		mem_free(base, rl);
+	}
+}
+
+/*
+ * Create a group whose reads and writes are limited to rate bytes per
+ * second with bursts of up to burst bytes each.  A rate of zero means no
+ * limit and a burst of zero means one second worth of the rate.
+ */
+struct litev_rl *
+litev_rl_init(struct litev_base *base, const struct litev_rl_opts *opts)
+{
+	struct litev_rl		*rl;
+	struct rl_bucket	*b;
+	unsigned long long	 now;
+	int			 i;
+
+	if (base == NULL || opts == NULL)
+		return (NULL);
+
+	if ((rl = mem_malloc(base, sizeof(struct litev_rl))) == NULL)
+		return (NULL);
+	memset(rl, 0, sizeof(struct litev_rl));
+	rl->base = base;
+
+	now = timer_now();
+	for (i = 0; i < 2; ++i) {
+		b = &rl->bucket[i];
+		b->rl = rl;
+		litev_timer_init(&b->timer, rl_wakeup, b);
+		b->condition = i == 0 ? LITEV_READ : LITEV_WRITE;
+		b->rate = i == 0 ? opts->read_rate : opts->write_rate;
+		b->burst = i == 0 ? opts->read_burst : opts->write_burst;
+		if (b->burst == 0)
+			b->burst = b->rate;
+		b->tokens = b->burst;
+		b->last = now;
+	}
+
+	rl->next = base->rls;
+	base->rls = rl;
+
+	return (rl);
+}
+
+/*
+ * Free the group and give all of its suspended events back to the kernel.
+ */
+void
+litev_rl_free(struct litev_rl **rl_ptr)
+{
+	struct litev_rl	*rl;
+	int		 i;
+
+	if (rl_ptr == NULL || (rl = *rl_ptr) == NULL)
+		return;
+
+	while (rl->nfd > 0)
+		litev_rl_del(rl, rl->fds[rl->nfd - 1]);
+	for (i = 0; i < 2; ++i)
+		litev_timer_del(rl->base, &rl->bucket[i].timer);
+	rl_unlink(rl);
+
+	mem_free(rl->base, rl->fds);
+	mem_free(rl->base, rl);
+	*rl_ptr = NULL;
+}
+
+/*
+ * Add fd to the group.  Its events are suspended along with the group, as
+ * long as they are registered by the time that a bucket runs empty.
+ */
+int
+litev_rl_add(struct litev_rl *rl, int fd)
+{
+	int	*n_fds;
+	size_t	 i, n_maxfd;
+
+	if (rl == NULL || fd < 0)
+		return (LITEV_EINVAL);
+	for (i = 0; i < rl->nfd; ++i) {
+		if (rl->fds[i] == fd)
+			return (LITEV_EEXIST);
+	}
+
+	if (rl->nfd == rl->maxfd) {
+		if (SIZE_MAX - GROW < rl->maxfd)
+			return (LITEV_EOVERFLOW);
+		n_maxfd = rl->maxfd + GROW;
+		n_fds = mem_reallocarray(rl->base, rl->fds, n_maxfd,
+		    sizeof(int));
+		if (n_fds == NULL)
+			return (-1);
+		rl->fds = n_fds;
+		rl->maxfd = n_maxfd;
+	}
+	rl->fds[rl->nfd++] = fd;
+
+	for (i = 0; i < 2; ++i) {
+		if (rl->bucket[i].is_suspended)
+			rl_suspend(rl->base, fd, rl->bucket[i].condition);
+	}
+
+	return (LITEV_OK);
+}
+
+int
+litev_rl_del(struct litev_rl *rl, int fd)
+{
+	size_t	i;
+	int	j;
+
+	if (rl == NULL || fd < 0)
+		return (LITEV_EINVAL);
+
+	for (i = 0; i < rl->nfd; ++i) {
+		if (rl->fds[i] == fd)
+			break;
+	}
+	if (i == rl->nfd)
+		return (LITEV_ENOENT);
+	rl->fds[i] = rl->fds[--rl->nfd];
+
+	for (j = 0; j < 2; ++j) {
+		if (rl->bucket[j].is_suspended)
+			rl_resume(rl->base, fd, rl->bucket[j].condition);
+	}
+
+	return (LITEV_OK);
+}
+
+/*
+ * Return the amount of bytes that may be read or written right now.
+ */
+size_t
+litev_rl_avail(struct litev_rl *rl, short condition)
+{
+	struct rl_bucket	*b;
+
+	if (rl == NULL || (b = rl_bucket(rl, condition)) == NULL)
+		return (0);
+	if (b->rate == 0)
+		return (SIZE_MAX);
+
+	rl_fill(b, timer_now());
+
+	return (b->tokens < 1 ? 0 : (size_t)b->tokens);
+}
+
+/*
+ * Account for n bytes that have been read or written by a member of the
+ * group.  Once the bucket is empty, the events of condition of all members
+ * are suspended until it has been refilled.
+ */
+int
+litev_rl_consume(struct litev_rl *rl, short condition, size_t n)
+{
+	struct rl_bucket	*b;
+	size_t			 i;
+	int			 rc;
+
+	if (rl == NULL || (b = rl_bucket(rl, condition)) == NULL)
+		return (LITEV_EINVAL);
+	if (b->rate == 0)
+		return (LITEV_OK);
+
+	rl_fill(b, timer_now());
+	b->tokens -= n;
+	if (b->tokens >= 1 || b->is_suspended)
+		return (LITEV_OK);
+
+	/* Without a timer, the bucket would never be resumed. */
+	if ((rc = rl_arm(b)) != LITEV_OK)
+		return (rc);
+	b->is_suspended = 1;
+	for (i = 0; i < rl->nfd; ++i)
+		rl_suspend(rl->base, rl->fds[i], condition);
+
+	return (LITEV_OK);
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2022-2024 Emil Engler <me@emilengler.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+/*
+ * A token bucket, whose tokens may become negative if more than the
+ * available amount has been consumed at once.  It is suspended while the
+ * events of its condition are taken out of the kernel, until its timer
+ * fires.
+ */
+struct rl_bucket {
+	struct litev_rl		*rl;
+	struct litev_timer	 timer;
+	double			 rate;		/* Tokens per second. */
+	double			 burst;
+	double			 tokens;
+	unsigned long long	 last;		/* Time of the last refill. */
+	short			 condition;
+	int			 is_suspended;
+};
+
+/* The groups of a base are kept in a singly linked list. */
+struct litev_rl {
+	struct litev_rl		*next;
+	struct litev_base	*base;
+	struct rl_bucket	 bucket[2];
+	int			*fds;
+	size_t			 nfd;
+	size_t			 maxfd;
+};
+
+void	rl_close(struct litev_base *, int);
+void	rl_free(struct litev_base *);
+int	rl_is_suspended(struct litev_base *, int, short);
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2022-2024 Emil Engler <me@emilengler.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Check the ready queue of the null backend against callbacks that inject
+ * and remove other events.  The FDs are made up, as the null backend never
+ * passes them to the kernel, hence they are removed with litev_del() rather
+ * than litev_close().
+ */
+
+#include <err.h>
+#include <stdio.h>
+
+#include "litev.h"
+
+#define FD_A	10
+#define FD_B	11
+#define FD_C	12
+#define FD_D	13
+#define NFD	14
+
+static void	add(int);
+static void	cb(int, short, void *);
+static void	del(int);
+static void	inject(int);
+
+static struct litev_base	*base;
+static int			 ncalls[NFD];
+
+static void
+add(int fd)
+{
+	struct litev_ev	ev;
+
+	ev.fd = fd;
+	ev.condition = LITEV_READ;
+	ev.cb = cb;
+	ev.udata = NULL;
+	if (litev_add(base, &ev) != LITEV_OK)
+		errx(1, "litev_add %d", fd);
+}
+
+/*
+ * A injects B, C and D for the next poll, but removes C right away, which
+ * leaves a hole in the ready queue.  B then removes D, before it is
+ * delivered.
+ */
+static void
+cb(int fd, short condition, void *udata)
+{
+	++ncalls[fd];
+
+	switch (fd) {
+	case FD_A:
+		inject(FD_B);
+		inject(FD_C);
+		inject(FD_D);
+		del(FD_C);
+		break;
+	case FD_B:
+		del(FD_D);
+		break;
+	}
+}
+
+static void
+del(int fd)
+{
+	struct litev_ev	ev;
+
+	ev.fd = fd;
+	ev.condition = LITEV_READ;
+	if (litev_del(base, &ev) != LITEV_OK)
+		errx(1, "litev_del %d", fd);
+}
+
+static void
+inject(int fd)
+{
+	if (litev_null_inject(base, fd, LITEV_READ) != LITEV_OK)
+		errx(1, "litev_null_inject %d", fd);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int	i, fd;
+	int	expect[NFD] = {
+		[FD_A] = 1, [FD_B] = 1, [FD_C] = 0, [FD_D] = 0
+	};
+
+	if ((base = litev_init_backend("null")) == NULL)
+		errx(1, "litev_init_backend");
+
+	for (fd = FD_A; fd <= FD_D; ++fd)
+		add(fd);
+	inject(FD_A);
+
+	/* Every callback must run at most once, however often we poll. */
+	for (i = 0; i < 3; ++i) {
+		if (litev_loop(base, LITEV_NOWAIT) != LITEV_OK)
+			errx(1, "litev_loop");
+	}
+
+	for (fd = FD_A; fd <= FD_D; ++fd) {
+		if (ncalls[fd] != expect[fd]) {
+			errx(1, "fd %d: %d callbacks instead of %d", fd,
+			    ncalls[fd], expect[fd]);
+		}
+	}
+
+	litev_free(&base);
+	puts("ok");
+
+	return (0);
+}
@@ -0,0 +1,302 @@
+/*
+ * Copyright (c) 2022-2024 Emil Engler <me@emilengler.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Required for clock_gettime(2). */
+#define _POSIX_C_SOURCE	200809L
+
+#include "config.h"
+
+#include <sys/types.h>
+
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "litev.h"
+#include "litev-internal.h"
+#include "mem.h"
+#include "timer.h"
+
+#define GROW	64
+
+/*
+ * The backends wait with a resolution of one millisecond, hence timers whose
+ * deadlines are at most this far apart share a wakeup even without slack.
+ */
+#define RESOLUTION	1000000
+
+/*
+ * The armed timers are kept in a binary min-heap ordered by the end of their
+ * slack window, like the soft and hard expiry of hrtimers in Linux.  The loop
+ * sleeps until the earliest end of a window and then fires all timers whose
+ * deadline has passed, so that timers with overlapping windows share a
+ * wakeup.  The idx of a timer is its position inside the heap plus one and
+ * zero while the timer is not armed.
+ */
+
+static void	timer_swap(struct litev_base *, size_t, size_t);
+static void	timer_up(struct litev_base *, size_t);
+static void	timer_down(struct litev_base *, size_t);
+static void	timer_remove(struct litev_base *, struct litev_timer *);
+
+unsigned long long
+timer_now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+static void
+timer_swap(struct litev_base *base, size_t i, size_t j)
+{
+	struct litev_timer	*t;
+
+	t = base->timers[i];
+	base->timers[i] = base->timers[j];
+	base->timers[j] = t;
+	base->timers[i]->idx = i + 1;
+	base->timers[j]->idx = j + 1;
+}
+
+static void
+timer_up(struct litev_base *base, size_t i)
+{
+	size_t	parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (base->timers[parent]->latest <= base->timers[i]->latest)
+			break;
+		timer_swap(base, i, parent);
+		i = parent;
+	}
+}
+
+static void
+timer_down(struct litev_base *base, size_t i)
+{
+	size_t	child;
+
+	while ((child = 2 * i + 1) < base->ntimer) {
+		if (child + 1 < base->ntimer &&
+		    base->timers[child + 1]->latest <
+		    base->timers[child]->latest)
+			++child;
+		if (base->timers[i]->latest <= base->timers[child]->latest)
+			break;
+		timer_swap(base, i, child);
+		i = child;
+	}
+}
+
+static void
+timer_remove(struct litev_base *base, struct litev_timer *t)
+{
+	size_t	i;
+
+	i = t->idx - 1;
+	t->idx = 0;
+	if (i == --base->ntimer)
+		return;
+
+	base->timers[i] = base->timers[base->ntimer];
+	base->timers[i]->idx = i + 1;
+	timer_up(base, i);
+	timer_down(base, i);
+}
+
+/*
+ * Arm t to fire in nsec nanoseconds, or move its deadline if it is armed
+ * already.
+ */
+int
+timer_add(struct litev_base *base, struct litev_timer *t,
+    unsigned long long nsec)
+{
+	struct litev_timer	**n_timers;
+	unsigned long long	  now, slack;
+	size_t			  n_maxtimer;
+
+	if (t->idx == 0 && base->ntimer == base->maxtimer) {
+		if (SIZE_MAX - GROW < base->maxtimer)
+			return (LITEV_EOVERFLOW);
+		n_maxtimer = base->maxtimer + GROW;
+		n_timers = mem_reallocarray(base, base->timers, n_maxtimer,
+		    sizeof(struct litev_timer *));
+		if (n_timers == NULL)
+			return (-1);
+		base->timers = n_timers;
+		base->maxtimer = n_maxtimer;
+	}
+
+	now = timer_now();
+	slack = t->slack > ULLONG_MAX / 1000 ? ULLONG_MAX : t->slack * 1000;
+	if (slack < base->slack)
+		slack = base->slack;
+	t->deadline = nsec > ULLONG_MAX - now ? ULLONG_MAX : now + nsec;
+	t->latest = slack > ULLONG_MAX - t->deadline ? ULLONG_MAX :
+	    t->deadline + slack;
+
+	if (t->idx != 0) {
+		timer_up(base, t->idx - 1);
+		timer_down(base, t->idx - 1);
+		return (LITEV_OK);
+	}
+
+	base->timers[base->ntimer] = t;
+	t->idx = ++base->ntimer;
+	timer_up(base, t->idx - 1);
+
+	return (LITEV_OK);
+}
+
+/*
+ * Shorten timeout to the end of the earliest slack window, storing the
+ * result in ts if necessary.
+ */
+const struct timespec *
+timer_timeout(struct litev_base *base, const struct timespec *timeout,
+    struct timespec *ts)
+{
+	unsigned long long	now, latest, wait;
+
+	if (base->ntimer == 0)
+		return (timeout);
+
+	now = timer_now();
+	latest = base->timers[0]->latest;
+	wait = latest > now ? latest - now : 0;
+
+	ts->tv_sec = wait / 1000000000 > INT_MAX ? INT_MAX : wait / 1000000000;
+	ts->tv_nsec = wait % 1000000000;
+	if (timeout != NULL && (timeout->tv_sec < ts->tv_sec ||
+	    (timeout->tv_sec == ts->tv_sec &&
+	    timeout->tv_nsec <= ts->tv_nsec)))
+		return (timeout);
+
+	return (ts);
+}
+
+/*
+ * Fire all timers whose deadline has passed.  A timer with slack whose
+ * deadline lies beyond the wakeup that the previous one would have needed
+ * without slack has saved a wakeup.
+ */
+void
+timer_run(struct litev_base *base)
+{
+	struct litev_timer	*t;
+	unsigned long long	 now, wakeup;
+
+	now = timer_now();
+	wakeup = 0;
+	while (base->ntimer > 0 && (t = base->timers[0])->deadline <= now) {
+		timer_remove(base, t);
+
+		if (wakeup != 0 && t->deadline > wakeup &&
+		    t->latest > t->deadline)
+			++base->stats.nwakeups_saved;
+		if (wakeup == 0 || t->deadline > wakeup)
+			wakeup = t->deadline + RESOLUTION;
+
+		++base->stats.ntimers;
+		t->cb(t->udata);
+	}
+}
+
+void
+timer_free(struct litev_base *base)
+{
+	size_t	i;
+
+	for (i = 0; i < base->ntimer; ++i)
+		base->timers[i]->idx = 0;
+	mem_free(base, base->timers);
+	base->timers = NULL;
+	base->ntimer = 0;
+	base->maxtimer = 0;
+}
+
+void
+litev_timer_init(struct litev_timer *t, void (*cb)(void *), void *udata)
+{
+	if (t == NULL)
+		return;
+
+	t->cb = cb;
+	t->udata = udata;
+	t->slack = 0;
+	t->deadline = 0;
+	t->latest = 0;
+	t->idx = 0;
+}
+
+/*
+ * Arm t to fire once in usec microseconds, or move its deadline if it is
+ * armed already.  It may fire up to its slack or the slack of the base,
+ * whichever is larger, after its deadline.
+ */
+int
+litev_timer_add(struct litev_base *base, struct litev_timer *t,
+    unsigned long long usec)
+{
+	if (base == NULL || t == NULL || t->cb == NULL)
+		return (LITEV_EINVAL);
+	if (usec > ULLONG_MAX / 1000)
+		return (LITEV_EOVERFLOW);
+
+	return (timer_add(base, t, usec * 1000));
+}
+
+int
+litev_timer_del(struct litev_base *base, struct litev_timer *t)
+{
+	if (base == NULL || t == NULL)
+		return (LITEV_EINVAL);
+	if (t->idx == 0 || t->idx > base->ntimer ||
+	    base->timers[t->idx - 1] != t)
+		return (LITEV_ENOENT);
+
+	timer_remove(base, t);
+
+	return (LITEV_OK);
+}
+
+int
+litev_timer_pending(const struct litev_timer *t)
+{
+	return (t != NULL && t->idx != 0);
+}
+
+/*
+ * Set the slack in microseconds that every timer of the base has at least.
+ * It applies to the timers armed from now on.
+ */
+int
+litev_timer_slack(struct litev_base *base, unsigned long long usec)
+{
+	if (base == NULL)
+		return (LITEV_EINVAL);
+	if (usec > ULLONG_MAX / 1000)
+		return (LITEV_EOVERFLOW);
+
+	base->slack = usec * 1000;
+
+	return (LITEV_OK);
+}
@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2022-2024 Emil Engler <me@emilengler.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Decode a trace written by litev_trace_dump() into one line per record:
+ *
+ *	time [us]	event	fd/nready	condition	duration [us]
+ *
+ * The duration is printed for the end of a callback and for the end of a
+ * wait, measured from its corresponding beginning.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "litev.h"
+
+static const char	*cond_name(short);
+static const char	*type_name(unsigned short);
+static double		 us(unsigned long long, unsigned long long);
+
+static unsigned long long	tsc_hz;
+
+static const char *
+cond_name(short condition)
+{
+	switch (condition) {
+	case LITEV_READ:
+		return ("read");
+	case LITEV_WRITE:
+		return ("write");
+	case LITEV_ERRQUEUE:
+		return ("errqueue");
+	default:
+		return ("-");
+	}
+}
+
+static const char *
+type_name(unsigned short type)
+{
+	switch (type) {
+	case LITEV_TRACE_WAIT:
+		return ("wait");
+	case LITEV_TRACE_READY:
+		return ("ready");
+	case LITEV_TRACE_ADD:
+		return ("add");
+	case LITEV_TRACE_DEL:
+		return ("del");
+	case LITEV_TRACE_CLOSE:
+		return ("close");
+	case LITEV_TRACE_CB_BEGIN:
+		return ("cb-begin");
+	case LITEV_TRACE_CB_END:
+		return ("cb-end");
+	default:
+		return ("unknown");
+	}
+}
+
+static double
+us(unsigned long long from, unsigned long long to)
+{
+	return ((double)(to - from) / tsc_hz * 1000000);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct litev_trace_hdr	hdr;
+	struct litev_trace_rec	rec;
+	unsigned long long	first, wait, cb;
+	FILE			*fp;
+	int			 is_first;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: trace-decode file\n");
+		return (1);
+	}
+
+	if ((fp = fopen(argv[1], "rb")) == NULL) {
+		perror(argv[1]);
+		return (1);
+	}
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    memcmp(hdr.magic, "LITEVTR1", sizeof(hdr.magic)) != 0 ||
+	    hdr.tsc_hz == 0) {
+		fprintf(stderr, "%s: not a litev trace\n", argv[1]);
+		return (1);
+	}
+	tsc_hz = hdr.tsc_hz;
+
+	printf("# %llu records, counter at %llu Hz\n", hdr.nrec, hdr.tsc_hz);
+
+	first = wait = cb = 0;
+	is_first = 1;
+	while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+		if (is_first) {
+			first = rec.tsc;
+			is_first = 0;
+		}
+
+		printf("%.3f\t%s\t%d\t%s", us(first, rec.tsc),
+		    type_name(rec.type), rec.arg, cond_name(rec.condition));
+
+		switch (rec.type) {
+		case LITEV_TRACE_WAIT:
+			wait = rec.tsc;
+			break;
+		case LITEV_TRACE_READY:
+			if (wait != 0)
+				printf("\t%.3f", us(wait, rec.tsc));
+			break;
+		case LITEV_TRACE_CB_BEGIN:
+			cb = rec.tsc;
+			break;
+		case LITEV_TRACE_CB_END:
+			if (cb != 0)
+				printf("\t%.3f", us(cb, rec.tsc));
+			break;
+		}
+		putchar('\n');
+	}
+
+	fclose(fp);
+
+	return (0);
+}
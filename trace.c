@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2022-2024 Emil Engler <me@emilengler.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Required for clock_gettime(2). */
+#define _POSIX_C_SOURCE	200809L
+
+#include "config.h"
+
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "litev.h"
+#include "litev-internal.h"
+#include "trace.h"
+#include "mem.h"
+
+#ifdef LITEV_TRACE
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#if (LITEV_TRACE_SIZE & (LITEV_TRACE_SIZE - 1)) != 0
+#error "LITEV_TRACE_SIZE must be a power of two"
+#endif
+
+static unsigned long long	trace_ns(void);
+static unsigned long long	trace_tsc(void);
+
+static unsigned long long
+trace_ns(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+/*
+ * Read the cycle counter of the CPU, which is a lot cheaper than
+ * clock_gettime(2).  Other architectures fall back to the monotonic clock,
+ * in which case the counter runs at exactly 1 GHz.
+ */
+static unsigned long long
+trace_tsc(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return (__rdtsc());
+#elif defined(__aarch64__)
+	unsigned long long	v;
+
+	__asm__ __volatile__("mrs %0, cntvct_el0" : "=r" (v));
+	return (v);
+#else
+	return (trace_ns());
+#endif
+}
+
+int
+trace_init(struct litev_base *base)
+{
+	struct trace	*trace;
+
+	if ((trace = mem_malloc(base, sizeof(struct trace))) == NULL)
+		return (-1);
+
+	trace->head = 0;
+	trace->ns0 = trace_ns();
+	trace->tsc0 = trace_tsc();
+	base->trace = trace;
+
+	return (LITEV_OK);
+}
+
+void
+trace_free(struct litev_base *base)
+{
+	mem_free(base, base->trace);
+	base->trace = NULL;
+}
+
+/*
+ * Append a record to the ring, overwriting the oldest one if it is full.
+ * This is on the hot path of every callback, so it must stay trivial.
+ */
+void
+trace_rec(struct litev_base *base, int type, int arg, short condition)
+{
+	struct trace		*trace;
+	struct litev_trace_rec	*rec;
+
+	trace = base->trace;
+	rec = &trace->ring[trace->head++ & (LITEV_TRACE_SIZE - 1)];
+	rec->tsc = trace_tsc();
+	rec->arg = arg;
+	rec->type = type;
+	rec->condition = condition;
+}
+
+/*
+ * Write the content of the ring, from the oldest to the newest record, to
+ * path.  As the ring is not locked, this must be called from the thread
+ * that dispatches the loop, for example from a callback or after
+ * litev_dispatch() returned.
+ */
+int
+litev_trace_dump(struct litev_base *base, const char *path)
+{
+	struct litev_trace_hdr	 hdr;
+	struct trace		*trace;
+	unsigned long long	 i, dns, dtsc;
+	FILE			*fp;
+
+	if (base == NULL || path == NULL)
+		return (LITEV_EINVAL);
+	trace = base->trace;
+
+	memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+	dns = trace_ns() - trace->ns0;
+	dtsc = trace_tsc() - trace->tsc0;
+	if (dns == 0)
+		hdr.tsc_hz = 1000000000;
+	else
+		hdr.tsc_hz = (double)dtsc / dns * 1000000000;
+	i = 0;
+	if (trace->head > LITEV_TRACE_SIZE)
+		i = trace->head - LITEV_TRACE_SIZE;
+	hdr.nrec = trace->head - i;
+
+	if ((fp = fopen(path, "wb")) == NULL)
+		return (-1);
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+		goto err;
+	for (; i < trace->head; ++i) {
+		if (fwrite(&trace->ring[i & (LITEV_TRACE_SIZE - 1)],
+		    sizeof(struct litev_trace_rec), 1, fp) != 1)
+			goto err;
+	}
+	if (fclose(fp) == EOF)
+		return (-1);
+
+	return (LITEV_OK);
+err:
+	fclose(fp);
+	return (-1);
+}
+
+#else
+
+int
+trace_init(struct litev_base *base)
+{
+	base->trace = NULL;
+	return (LITEV_OK);
+}
+
+void
+trace_free(struct litev_base *base)
+{
+}
+
+int
+litev_trace_dump(struct litev_base *base, const char *path)
+{
+	return (LITEV_ENOTSUP);
+}
+
+#endif
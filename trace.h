@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2022-2024 Emil Engler <me@emilengler.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/* The amount of records inside the ring, must be a power of two. */
+#ifndef LITEV_TRACE_SIZE
+#define LITEV_TRACE_SIZE	65536
+#endif
+
+#define TRACE_MAGIC		"LITEVTR1"
+
+/*
+ * The ring is only ever written by the thread that dispatches the loop.
+ * head counts all records ever written, so that the oldest record is
+ * found at head - LITEV_TRACE_SIZE once the ring has wrapped around.
+ * tsc0 and ns0 are taken at the same time and serve to calibrate the
+ * timestamps when dumping.
+ */
+struct trace {
+	struct litev_trace_rec	ring[LITEV_TRACE_SIZE];
+	unsigned long long	head;
+	unsigned long long	tsc0;
+	unsigned long long	ns0;
+};
+
+int	trace_init(struct litev_base *);
+void	trace_free(struct litev_base *);
+
+#endif
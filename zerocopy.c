@@ -0,0 +1,345 @@
+/*
+ * Copyright (c) 2022-2024 Emil Engler <me@emilengler.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Required for MSG_ZEROCOPY and SO_ZEROCOPY. */
+#define _GNU_SOURCE
+
+#include "config.h"
+
+#include <sys/types.h>
+
+#include <stdlib.h>
+
+#include "litev.h"
+#include "litev-internal.h"
+#include "mem.h"
+
+#ifdef USE_ZEROCOPY
+
+#include <sys/socket.h>
+
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#define GROW	16
+
+/* A buffer that is still referenced by the kernel. */
+struct zc_buf {
+	void		*buf;
+	void		*udata;
+	uint32_t	 seq;
+};
+
+/*
+ * The kernel numbers every successful send(2) with MSG_ZEROCOPY on a socket,
+ * starting at zero.  seq mirrors this counter, so that the ranges reported
+ * on the error queue can be mapped back to the buffers in pending, which is
+ * ordered by the sequence number.
+ */
+struct litev_zc {
+	struct litev_base	*base;
+	struct zc_buf		*pending;
+	size_t			 npending;
+	size_t			 maxpending;
+	size_t			 threshold;
+	uint32_t		 seq;
+	int			 fd;
+	int			 error;		/* Taken off by zc_cb(). */
+	int			 is_enabled;
+	struct litev_handle	 handle;	/* Of LITEV_ERRQUEUE. */
+	void			 (*cb)(int, void *, void *);
+};
+
+static void	zc_cb(int, short, void *);
+static int	zc_grow(struct litev_zc *);
+static void	zc_release(struct litev_zc *, uint32_t, uint32_t);
+
+/*
+ * Drain the error queue of the socket and release all buffers whose
+ * transmission has been completed.  The condition is also reported for a
+ * pending socket error, which is cleared and kept for the next send, as it
+ * would otherwise be reported again forever.
+ */
+static void
+zc_cb(int fd, short condition, void *udata)
+{
+	struct litev_zc			*zc;
+	struct sock_extended_err	*serr;
+	struct cmsghdr			*cm;
+	struct msghdr			 msg;
+	socklen_t			 len;
+	int				 error;
+	char				 control[128];
+
+	zc = udata;
+
+	for (;;) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		/* Reading from the error queue never blocks. */
+		if (recvmsg(fd, &msg, MSG_ERRQUEUE) == -1)
+			break;
+
+		for (cm = CMSG_FIRSTHDR(&msg); cm != NULL;
+		    cm = CMSG_NXTHDR(&msg, cm)) {
+			if (!(cm->cmsg_level == SOL_IP &&
+			    cm->cmsg_type == IP_RECVERR) &&
+			    !(cm->cmsg_level == SOL_IPV6 &&
+			    cm->cmsg_type == IPV6_RECVERR))
+				continue;
+
+			serr = (struct sock_extended_err *)CMSG_DATA(cm);
+			if (serr->ee_errno != 0 ||
+			    serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+
+			/*
+			 * The kernel had to copy the data anyway, for example
+			 * because the route goes over the loopback device.
+			 * Zero-copy cannot pay off here, so stop using it.
+			 */
+			if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				zc->is_enabled = 0;
+
+			zc_release(zc, serr->ee_info, serr->ee_data);
+		}
+	}
+
+	if (errno != EAGAIN)
+		return;
+	len = sizeof(error);
+	if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) == 0 &&
+	    error != 0)
+		zc->error = error;
+}
+
+static int
+zc_grow(struct litev_zc *zc)
+{
+	struct zc_buf	*n_pending;
+	size_t		 n_maxpending;
+
+	/* No growth required. */
+	if (zc->npending != zc->maxpending)
+		return (LITEV_OK);
+
+	/* Check for integer overflows. */
+	if (SIZE_MAX - GROW < zc->maxpending)
+		return (LITEV_EOVERFLOW);
+	n_maxpending = zc->maxpending + GROW;
+	if (n_maxpending > SIZE_MAX / sizeof(struct zc_buf))
+		return (LITEV_EOVERFLOW);
+
+	n_pending = mem_reallocarray(zc->base, zc->pending, n_maxpending,
+	    sizeof(struct zc_buf));
+	if (n_pending == NULL)
+		return (-1);
+
+	zc->pending = n_pending;
+	zc->maxpending = n_maxpending;
+
+	return (LITEV_OK);
+}
+
+/*
+ * Hand all pending buffers with a sequence number inside [lo, hi] back to
+ * the application.  The range may wrap around.
+ */
+static void
+zc_release(struct litev_zc *zc, uint32_t lo, uint32_t hi)
+{
+	struct zc_buf	b;
+	size_t		i;
+
+	i = 0;
+	while (i < zc->npending) {
+		if ((uint32_t)(zc->pending[i].seq - lo) >
+		    (uint32_t)(hi - lo)) {
+			++i;
+			continue;
+		}
+
+		/*
+		 * Remove the buffer before executing the callback, because
+		 * the callback may send more data and thus modify pending.
+		 */
+		b = zc->pending[i];
+		memmove(&zc->pending[i], &zc->pending[i + 1],
+		    sizeof(struct zc_buf) * (zc->npending - i - 1));
+		--zc->npending;
+
+		zc->cb(zc->fd, b.buf, b.udata);
+	}
+}
+
+struct litev_zc *
+litev_zc_init(struct litev_base *base, int fd, size_t threshold,
+    void (*cb)(int, void *, void *))
+{
+	struct litev_zc	*zc;
+	struct litev_ev	 ev;
+	int		 one;
+
+	if (base == NULL || fd < 0 || cb == NULL)
+		return (NULL);
+
+	if ((zc = mem_malloc(base, sizeof(struct litev_zc))) == NULL)
+		return (NULL);
+
+	zc->base = base;
+	zc->pending = NULL;
+	zc->npending = 0;
+	zc->maxpending = 0;
+	zc->threshold = threshold;
+	zc->seq = 0;
+	zc->fd = fd;
+	zc->error = 0;
+	zc->cb = cb;
+
+	/*
+	 * Older kernels and sockets other than TCP do not support
+	 * SO_ZEROCOPY, in which case all data will simply be copied.
+	 */
+	one = 1;
+	zc->is_enabled = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one,
+	    sizeof(one)) == 0;
+
+	/* Completions are reported through the error queue of the socket. */
+	if (zc->is_enabled) {
+		ev.fd = fd;
+		ev.condition = LITEV_ERRQUEUE;
+		ev.cb = zc_cb;
+		ev.udata = zc;
+		if (litev_add_handle(base, &ev, &zc->handle) != LITEV_OK) {
+			mem_free(base, zc);
+			return (NULL);
+		}
+	}
+
+	return (zc);
+}
+
+void
+litev_zc_free(struct litev_zc **zc_ptr)
+{
+	struct litev_zc	*zc;
+	size_t		 i;
+
+	if (zc_ptr == NULL || *zc_ptr == NULL)
+		return;
+	zc = *zc_ptr;
+
+	/*
+	 * The handle is stale, if the FD has been closed before, in which
+	 * case its number may already belong to another registration.
+	 */
+	if (zc->is_enabled)
+		litev_del_handle(zc->base, &zc->handle);
+
+	/*
+	 * Return all buffers that are still pending to the application,
+	 * as no completion will ever be reported for them.
+	 */
+	for (i = 0; i < zc->npending; ++i)
+		zc->cb(zc->fd, zc->pending[i].buf, zc->pending[i].udata);
+
+	mem_free(zc->base, zc->pending);
+	mem_free(zc->base, zc);
+	*zc_ptr = NULL;
+}
+
+int
+litev_zc_send(struct litev_zc *zc, void *buf, size_t len, void *udata,
+    size_t *nsent)
+{
+	ssize_t	n;
+	int	rc;
+
+	if (zc == NULL || buf == NULL || nsent == NULL)
+		return (LITEV_EINVAL);
+
+	if (zc->error != 0) {
+		errno = zc->error;
+		zc->error = 0;
+		return (-1);
+	}
+
+	if (zc->is_enabled && len >= zc->threshold) {
+		/*
+		 * Make room for the buffer before sending it, because it
+		 * cannot be tracked anymore after a successful send(2).
+		 */
+		if ((rc = zc_grow(zc)) != LITEV_OK)
+			return (rc);
+
+		n = send(zc->fd, buf, len, MSG_ZEROCOPY);
+		if (n != -1) {
+			zc->pending[zc->npending].buf = buf;
+			zc->pending[zc->npending].udata = udata;
+			zc->pending[zc->npending].seq = zc->seq++;
+			++zc->npending;
+
+			*nsent = n;
+			return (LITEV_OK);
+		}
+
+		/*
+		 * ENOBUFS indicates that the socket has too many buffers
+		 * pinned in the kernel, in which case we fall back to
+		 * copying the data.
+		 */
+		if (errno != ENOBUFS)
+			return (errno == EAGAIN ? LITEV_EAGAIN : -1);
+	}
+
+	if ((n = send(zc->fd, buf, len, 0)) == -1)
+		return (errno == EAGAIN ? LITEV_EAGAIN : -1);
+
+	/* The data has been copied, so the buffer is free to use again. */
+	*nsent = n;
+	zc->cb(zc->fd, buf, udata);
+
+	return (LITEV_OK);
+}
+
+#else
+
+struct litev_zc *
+litev_zc_init(struct litev_base *base, int fd, size_t threshold,
+    void (*cb)(int, void *, void *))
+{
+	return (NULL);
+}
+
+void
+litev_zc_free(struct litev_zc **zc_ptr)
+{
+}
+
+int
+litev_zc_send(struct litev_zc *zc, void *buf, size_t len, void *udata,
+    size_t *nsent)
+{
+	return (LITEV_ENOTSUP);
+}
+
+#endif